@@ -22,3 +22,13 @@ SET(CMAKE_INCLUDE_CURRENT_DIR ON)
 FIND_PACKAGE(Qt5Core REQUIRED)
 FIND_PACKAGE(Qt5Network REQUIRED)
 
+# Optional io_uring support for the commit thread (Linux only).
+IF (CMAKE_SYSTEM_NAME MATCHES "Linux")
+  FIND_PATH(URING_INCLUDE_DIR liburing.h)
+  FIND_LIBRARY(URING_LIBRARY uring)
+  IF (URING_INCLUDE_DIR AND URING_LIBRARY)
+    SET(HAVE_IO_URING TRUE)
+    ADD_DEFINITIONS(-DHAVE_IO_URING)
+    INCLUDE_DIRECTORIES(${URING_INCLUDE_DIR})
+  ENDIF()
+ENDIF()
@@ -0,0 +1,48 @@
+#ifndef EFDL_BUFFER_POOL_H
+#define EFDL_BUFFER_POOL_H
+
+#include <QMap>
+#include <QList>
+#include <QMutex>
+#include <QByteArray>
+
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Recycles chunk buffers so that receiving and committing chunks does
+ * not allocate in steady state. Buffers are grouped in power-of-two
+ * size classes and at most a fixed amount of idle buffers are kept per
+ * class.
+ */
+class BufferPool {
+public:
+  BufferPool();
+  ~BufferPool();
+
+  void setMaxIdle(int count) { maxIdle = count; }
+
+  // Returns an empty buffer with capacity for at least size bytes.
+  QByteArray *acquire(qint64 size);
+
+  // Takes ownership and keeps the buffer for reuse if there is room.
+  void release(QByteArray *buffer);
+
+  quint64 getHits() const;
+  quint64 getMisses() const;
+  qint64 getPeakBytes() const;
+
+private:
+  static int sizeClass(qint64 size);
+
+  int maxIdle;
+  quint64 hits, misses;
+  qint64 bytes, peakBytes; // allocated by the pool, in use or idle
+  QMap<int, QList<QByteArray*>> idle; // size class -> buffers
+  mutable QMutex mutex;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_BUFFER_POOL_H
@@ -1,16 +1,28 @@
 #ifndef EFDL_COMMIT_THREAD_H
 #define EFDL_COMMIT_THREAD_H
 
+#include <QMap>
+#include <QSet>
 #include <QFile>
+#include <QPair>
 #include <QQueue>
 #include <QMutex>
 #include <QThread>
 #include <QString>
+#include <QDateTime>
 
+#include "Range.h"
+#include "RangeSet.h"
 #include "EfdlGlobal.h"
+#include "WriteBackend.h"
 
 BEGIN_NAMESPACE
 
+class BufferPool;
+class OutputSink;
+class MemoryBudget;
+class ResumeJournal;
+
 class CommitThread : public QThread {
   Q_OBJECT
   
@@ -21,17 +33,102 @@ public:
   // Takes ownership.
   void setFile(QFile *file) { this->file = file; }
 
+  // Does not take ownership. Data is written to it instead of the file.
+  void setSink(OutputSink *sink) { this->sink = sink; }
+
+  // Does not take ownership. Committed ranges are recorded in it.
+  void setJournal(ResumeJournal *journal) { this->journal = journal; }
+
+  void setBackendType(WriteBackend::Type type) { backendType = type; }
+
+  // Chunks were received directly into a mapping of the file so they
+  // only need to be recorded, not written.
+  void setMapped(bool mapped) { this->mapped = mapped; }
+
+  // Adjacent chunks are written together up to this amount of bytes.
+  void setCoalesceSize(qint64 size) { coalesceSize = size; }
+
+  // Does not take ownership. Written buffers are returned to it.
+  void setBufferPool(BufferPool *pool) { bufferPool = pool; }
+
+  // Does not take ownership. Written data is released from it.
+  void setMemoryBudget(MemoryBudget *budget) { memoryBudget = budget; }
+
+  // The output is a stream, like a pipe, so chunks are held back until
+  // everything before them has arrived and are then written in order.
+  void setOrdered(bool ordered) { this->ordered = ordered; }
+
+  // Keeps dirty pages and page cache usage of the output bounded.
+  void setDropCache(bool drop) { dropCache = drop; }
+
+  // Syncs the file to disk after the amount of bytes or seconds, if
+  // positive, and only then records the synced ranges in the journal.
+  void setSyncPolicy(qint64 bytes, int secs) {
+    syncBytes = bytes;
+    syncInterval = secs;
+  }
+
+  // Releases the chunks still queued and closes the file so the thread
+  // can be set up again. Only while it is not running.
+  void reset();
+
+  // Set when writing failed. The run then stops early without
+  // committing anything more.
+  bool hasError() const { return !error.isEmpty(); }
+  QString getError() const { return error; }
+
+  // Statistics of the last run.
+  QString getBackendName() const { return backendName; }
+  quint64 getSyscalls() const { return syscalls; }
+  qint64 getBytesWritten() const { return bytesWritten; }
+  qint64 getElapsed() const { return elapsed; }
+  int getSyncs() const { return syncs; }
+
+signals:
+  // Everything before the position has been written in order.
+  void streamed(qint64 pos);
+
 public slots:
-  void enqueueChunk(const QByteArray *data, bool last = false);
+  void enqueueChunk(qint64 pos, const QByteArray *data, bool last = false);
 
 private:
   void run() override;
   void cleanup();
+  QList<WriteBackend::Request>
+  reorder(const QList<WriteBackend::Request> &batch);
+  bool submit(QList<WriteBackend::Request> batch);
+  void commit(const QList<WriteBackend::Request> &requests);
+  void release(const QByteArray *data);
+  void checkpoint(bool force = false);
+  bool syncFile();
+  void writeBack(const Range &range);
+  void evict(qint64 maxPending);
   
   QFile *file;
-  bool last;
-  QQueue<const QByteArray*> queue;
+  OutputSink *sink;
+  ResumeJournal *journal;
+  WriteBackend *backend;
+  BufferPool *bufferPool;
+  MemoryBudget *memoryBudget;
+  WriteBackend::Type backendType;
+  bool last, dropCache, mapped, ordered;
+  qint64 coalesceSize, queuedBytes;
+  QDateTime lastSave, lastSync, started, firstQueued;
+  qint64 syncBytes;
+  int syncInterval, syncs;
+  RangeSet unsynced; // not yet synced
+  QQueue<Range> writeback; // [start, end[ ranges being written back
+  qint64 writebackBytes;
+  QQueue<WriteBackend::Request> queue;
   QMutex queueMutex;
+  QMap<qint64, const QByteArray*> held; // position -> data out of order
+  qint64 streamPos;
+  QSet<const QByteArray*> pending; // taken from the queue, not committed
+  QString error;
+
+  QString backendName;
+  quint64 syscalls;
+  qint64 bytesWritten, elapsed;
 };
 
 END_NAMESPACE
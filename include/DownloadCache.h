@@ -0,0 +1,68 @@
+#ifndef EFDL_DOWNLOAD_CACHE_H
+#define EFDL_DOWNLOAD_CACHE_H
+
+#include <QMap>
+#include <QUrl>
+#include <QString>
+#include <QDateTime>
+#include <QByteArray>
+
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Local cache of downloaded files that can be shared by several efdl
+ * processes. Files are stored once by content hash and found by URL and
+ * strong ETag. The least recently used files are evicted when the
+ * cache grows beyond its maximum size.
+ *
+ * All operations take a lock file in the cache directory, but files are
+ * copied into the cache before it is taken and only renamed under it.
+ */
+class DownloadCache {
+public:
+  DownloadCache();
+
+  void setDir(const QString &dir) { this->dir = dir; }
+  QString getDir() const { return dir; }
+
+  // Maximum total size of cached files, or -1 for no limit.
+  void setMaxSize(qint64 size) { maxSize = size; }
+  qint64 getMaxSize() const { return maxSize; }
+
+  // Whether fetched files may be hard links to the cached files where
+  // they cannot be reflinked. Such files are read-only and shared with
+  // the cache.
+  void setAllowLinks(bool allow) { allowLinks = allow; }
+  bool getAllowLinks() const { return allowLinks; }
+
+  // Places the cached copy of the URL at path. Returns false if there is
+  // none.
+  bool fetch(const QUrl &url, const QByteArray &etag, const QString &path);
+
+  // Adds a completed download to the cache.
+  bool store(const QUrl &url, const QByteArray &etag, const QString &path);
+
+private:
+  struct Object {
+    qint64 size;
+    QDateTime used;
+  };
+
+  static QString key(const QUrl &url, const QByteArray &etag);
+  QString objectPath(const QString &hash) const;
+  bool loadIndex();
+  bool saveIndex();
+  void evict();
+
+  QString dir;
+  qint64 maxSize;
+  bool allowLinks;
+  QMap<QString, QString> keys; // URL and ETag -> content hash
+  QMap<QString, Object> objects; // content hash -> object
+};
+
+END_NAMESPACE
+
+#endif // EFDL_DOWNLOAD_CACHE_H
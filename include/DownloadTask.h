@@ -12,19 +12,42 @@ class QUrl;
 
 BEGIN_NAMESPACE
 
+class BufferPool;
+class MemoryBudget;
+
 class DownloadTask : public QThread {
   Q_OBJECT
 
 public:
-  DownloadTask(const QUrl &url, Range range, int num,
+  DownloadTask(const QUrl &url, Range range, qint64 num,
                const QString &httpUser = QString(),
                const QString &httpPass = QString());
 
+  // Only accept partial content if the remote file still matches the
+  // validator (strong ETag or Last-Modified).
+  void setIfRange(const QByteArray &validator) { ifRange = validator; }
+
+  // Does not take ownership. Received data is read into its buffers.
+  void setBufferPool(BufferPool *pool) { bufferPool = pool; }
+
+  // Does not take ownership. Waits for room before requesting data.
+  void setMemoryBudget(MemoryBudget *budget) { memoryBudget = budget; }
+
+  // Reads the data directly into memory at target, like a mapping of the
+  // output file, instead of a buffer. It must have room for the range.
+  void setTarget(char *target) { this->target = target; }
+
+  // Largest amount of data passed on at once. Bigger ranges are passed
+  // on in segments as they are received, followed by the final one when
+  // finished.
+  static const qint64 MAX_SEGMENT{1073741824}; // 1 GB
+
 signals:
-  void started(int num);
-  void progress(int num, qint64 received, qint64 total);
-  void finished(int num, Range range, QByteArray *data);
-  void failed(int num, Range range, int httpCode,
+  void started(qint64 num);
+  void progress(qint64 num, qint64 received, qint64 total);
+  void segment(qint64 num, qint64 pos, QByteArray *data);
+  void finished(qint64 num, Range range, qint64 pos, QByteArray *data);
+  void failed(qint64 num, Range range, int httpCode,
               QNetworkReply::NetworkError error);
 
 protected:
@@ -34,10 +57,19 @@ private slots:
   void onProgress(qint64 received, qint64 total);
 
 private:
+  void readSegments(QNetworkReply *rep, QByteArray *&data, qint64 size,
+                    qint64 &pos, qint64 &held);
+  void handOff(QByteArray *data, qint64 &held);
+  void releaseData(QByteArray *data, qint64 held);
+
   const QUrl &url;
   Range range;
-  int num;
+  qint64 num;
   const QString &httpUser, &httpPass;
+  QByteArray ifRange;
+  BufferPool *bufferPool;
+  MemoryBudget *memoryBudget;
+  char *target;
 };
 
 END_NAMESPACE
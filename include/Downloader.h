@@ -5,10 +5,14 @@
 #include <QMap>
 #include <QPair>
 #include <QMutex>
-#include <QQueue>
+#include <QTimer>
+#include <QLockFile>
+#include <QScopedPointer>
 #include <QObject>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QByteArray>
+#include <QStringList>
 #include <QThreadPool>
 #include <QNetworkReply>
 #include <QCryptographicHash>
@@ -17,7 +21,14 @@
 #include "Range.h"
 #include "EfdlGlobal.h"
 #include "ThreadPool.h"
+#include "BufferPool.h"
+#include "MemoryBudget.h"
+#include "MetadataCache.h"
+#include "ValidatorStore.h"
+#include "DownloadCache.h"
+#include "OutputSink.h"
 #include "CommitThread.h"
+#include "ResumeJournal.h"
 
 class QUrl;
 class QNetworkReply;
@@ -33,63 +44,178 @@ public:
   QUrl getUrl() const { return url; }
 
   void setOutputDir(const QString &outputDir) { this->outputDir = outputDir; }
+  void setOutputFile(const QString &outputFile) {
+    this->outputFile = outputFile;
+  }
   void setConnections(int conns) { this->conns = conns; }
-  void setChunks(int chunks) { this->chunks = chunks; }
-  void setChunkSize(int size) { this->chunkSize = size; }
+  void setChunks(qint64 chunks) { this->chunks = chunks; }
+  void setChunkSize(qint64 size) { this->chunkSize = size; }
   void setConfirm(bool confirm) { this->confirm = confirm; }
   void setResume(bool resume) { this->resume = resume; }
+  void setResumeCheck(qint64 bytes) { this->resumeCheck = bytes; }
+  void setPreallocate(bool prealloc) { this->prealloc = prealloc; }
+  void setWriteBackend(WriteBackend::Type type) {
+    commitThread.setBackendType(type);
+  }
+  void setDropCache(bool drop) { commitThread.setDropCache(drop); }
+  void setWriteCoalesce(qint64 size) { commitThread.setCoalesceSize(size); }
+  void setSyncPolicy(qint64 bytes, int secs) {
+    commitThread.setSyncPolicy(bytes, secs);
+  }
+  void setMemoryMap(bool map) { useMap = map; }
+
+  // Takes ownership. Data goes to the sink instead of a file in the
+  // output directory. For ordered sinks, chunks arriving early are held
+  // back and no ranges are requested further ahead of what has been
+  // written than the window.
+  void setOutputSink(OutputSink *sink) { this->sink.reset(sink); }
+  void setStreamWindow(qint64 bytes) { streamWindow = bytes; }
+
+  // Does not take ownership. Sharing one manager lets downloaders reuse
+  // connections and TLS sessions to the same hosts when probing.
+  void setNetworkAccessManager(QNetworkAccessManager *mgr);
+
+  // Does not take ownership. Can be shared by several downloaders.
+  void setMemoryBudget(MemoryBudget *budget);
+
+  // Does not take ownership. Fresh entries are used instead of probing.
+  // If the remote file changed since, it is probed and downloaded again.
+  void setMetadataCache(MetadataCache *cache) { metadataCache = cache; }
+
+  // Does not take ownership. Skips the download if the local copy
+  // recorded in the store is still current and where the output would
+  // go, and records it otherwise.
+  void setValidatorStore(ValidatorStore *store) { validatorStore = store; }
+
+  // Does not take ownership. Completed downloads are added to the cache
+  // and files found in it are not downloaded.
+  void setDownloadCache(DownloadCache *cache) { downloadCache = cache; }
+
+  // Waits for other processes downloading the same URL and copies their
+  // result instead of downloading it again.
+  void setDedupe(bool dedupe) { this->dedupe = dedupe; }
   void setVerbose(bool verbose) { this->verbose = verbose; }
   void setDryRun(bool dryRun) { this->dryRun = dryRun; }
   void setShowHeaders(bool show) { this->showHeaders = show; }
   void setHttpCredentials(const QString &user, const QString &pass);
 
+  // Hashes computed from data still in memory, if possible, so the file
+  // does not have to be read again. Empty if not computed.
+  void setHashes(const QList<QCryptographicHash::Algorithm> &algs);
+  QByteArray getHash(QCryptographicHash::Algorithm alg) const {
+    return hashes.value(alg);
+  }
+
 signals:
+  void probeFinished();
   void finished();
-  void information(const QString &outputPath, qint64 size, int chunksAmount,
-                   int conns, qint64 offset);
+
+  // Emitted instead of finished() when the download cannot proceed. The
+  // error has already been printed, if any.
+  void failed(const QString &error);
+  void completedLocally(const QString &outputPath);
+  void information(const QString &outputPath, qint64 size,
+                   qint64 chunksAmount, int conns, qint64 offset);
 
   // Signals for individual chunks.
-  void chunkStarted(int num);
-  void chunkProgress(int num, qint64 received, qint64 total);
-  void chunkFinished(int num, Range range);
-  void chunkFailed(int num, Range range, int httpCode,
+  void chunkStarted(qint64 num);
+  void chunkProgress(qint64 num, qint64 received, qint64 total);
+  void chunkFinished(qint64 num, Range range);
+  void chunkFailed(qint64 num, Range range, int httpCode,
                    QNetworkReply::NetworkError error);
 
   // Internal signal.
-  void chunkToThread(const QByteArray *data, bool last);
+  void chunkToThread(qint64 pos, const QByteArray *data, bool last);
     
 public slots:
+  // Resolves the URL and fetches the headers without starting the
+  // download. Can be called ahead of start() which otherwise does it.
+  void probe();
   void start();
   void stop();
 
 private slots:
-  void onDownloadTaskFinished(int num, Range range, QByteArray *data);
-  void onDownloadTaskFailed(int num, Range range, int httpCode,
+  void onProbeFinished();
+  void onOwnerPoll();
+  void onDownloadTaskSegment(qint64 num, qint64 pos, QByteArray *data);
+  void onDownloadTaskFinished(qint64 num, Range range, qint64 pos,
+                              QByteArray *data);
+  void onDownloadTaskFailed(qint64 num, Range range, int httpCode,
                             QNetworkReply::NetworkError error);
   void onCommitThreadFinished();
+  void onStreamed(qint64 pos);
   
 private:
-  QNetworkReply *getHead(const QUrl &url);
+  void sendProbe(const QUrl &url);
+  void finishProbe(const QString &error = QString());
+  void fail(const QString &error = QString());
+  ResourceInfo readProbe();
+  QByteArray getValidator() const;
+  bool isUpToDate(const ResourceInfo &info) const;
+  void finishUpToDate();
+  void restart();
+  void recordValidators();
+  void begin();
+  void writeWhole();
+  void finishDownload(bool complete);
+  bool acquireTransfer();
+  void writeOwner(bool done);
+  QString readOwner(bool &done) const;
+  QString resolveOutputPath() const;
+  bool isOutputPath(const QString &path) const;
   bool setupFile();
+  bool setupSink();
+  // Returns false if the tail could not be compared, and otherwise
+  // whether it matches.
+  bool checkTail(const Range &committed, bool &match);
   void createRanges();
+  bool nextRange(Range &range);
   void setupThreadPool();
   void download();
-  void saveChunk();
+  void startTasks();
+  bool startTask();
+  void commitChunk(qint64 num, Range range, qint64 pos, QByteArray *data);
   
-  QUrl url;
-  QString outputDir, outputPath, httpUser, httpPass, fileOverride;
-  int conns, chunks, chunkSize, downloadCount, rangeCount;
-  qint64 contentLen, offset;
-  bool confirm, resume, verbose, dryRun, showHeaders, single, resumable;
-
-  QNetworkAccessManager netmgr;
+  QUrl url, origUrl;
+  QString outputDir, outputFile, outputPath, httpUser, httpPass, fileOverride;
+  QByteArray etag, lastModified, ifRange, probeData;
+  QMap<QCryptographicHash::Algorithm, QByteArray> hashes;
+  QStringList probeLog;
+  QString probeError;
+  int conns, hole;
+  qint64 chunks, chunkSize, downloadCount, rangeCount, nextNum, contentLen,
+    offset, resumeCheck, bytesReceived, rangeSize, cursor, probeSize;
+  int redirects;
+  bool confirm, resume, probing, probed, probeCut, startRequested, cached,
+    verbose, dryRun, showHeaders, single, resumable, prealloc, useMap,
+    restarting, restarted;
+  char *mapping;
+
+  QNetworkAccessManager ownNetmgr, *netmgr;
   QNetworkReply *reply;
 
   QMutex finishedMutex;
 
-  QQueue<Range> ranges;
+  QList<Range> missing; // [start, end[ ranges left to download
   ThreadPool pool;
-  QMap<qint64, QByteArray*> chunksMap; // range start -> data pointer
+  BufferPool bufferPool;
+  MemoryBudget *memoryBudget;
+  MetadataCache *metadataCache;
+  ResourceInfo cachedInfo;
+  ValidatorStore *validatorStore;
+  ValidatorStore::Entry localCopy;
+  bool hasLocalCopy;
+  DownloadCache *downloadCache;
+  bool dedupe;
+  QString ownerFile, ownerPath;
+  QScopedPointer<QLockFile> transferLock;
+  QTimer ownerTimer;
+  QScopedPointer<OutputSink> sink;
+  bool sinkOpen;
+  qint64 streamWindow, streamed;
+  int active;
+  QElapsedTimer probeTimer;
+  ResumeJournal journal;
   CommitThread commitThread;
 };
 
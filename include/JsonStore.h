@@ -0,0 +1,47 @@
+#ifndef EFDL_JSON_STORE_H
+#define EFDL_JSON_STORE_H
+
+#include <QUrl>
+#include <QString>
+#include <QJsonObject>
+#include <QStandardPaths>
+
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Base of the stores that keep entries keyed by URL in a JSON file of
+ * the user. Files of another version are ignored, and the file is
+ * only written when something changed and then atomically.
+ */
+class JsonStore {
+public:
+  void setPath(const QString &path) { this->path = path; }
+  QString getPath() const { return path; }
+
+protected:
+  // The name is used in warnings.
+  JsonStore(const QString &name, int version);
+
+  static QString locate(QStandardPaths::StandardLocation location,
+                        const QString &fileName);
+  static QString keyFor(const QUrl &url) {
+    return url.toString(QUrl::FullyEncoded);
+  }
+
+  // Returns false if the file could not be read or is invalid.
+  bool readEntries(QJsonObject &entries);
+  bool writeEntries(const QJsonObject &entries);
+
+  QString path;
+  bool dirty;
+
+private:
+  QString name;
+  int version;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_JSON_STORE_H
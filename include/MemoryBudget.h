@@ -0,0 +1,44 @@
+#ifndef EFDL_MEMORY_BUDGET_H
+#define EFDL_MEMORY_BUDGET_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Limits the amount of chunk data held in memory, from when a
+ * connection starts receiving a chunk until it has been committed. It
+ * can be shared by several downloaders.
+ */
+class MemoryBudget {
+public:
+  MemoryBudget(qint64 limit = -1);
+
+  void setLimit(qint64 limit);
+  qint64 getLimit() const;
+
+  // Waits up to timeout milliseconds, or forever if negative, for the
+  // bytes to fit. A request always fits when nothing else is held so
+  // chunks larger than the limit can still make progress.
+  bool acquire(qint64 bytes, int timeout = -1);
+
+  // Accounts for bytes without waiting.
+  void reserve(qint64 bytes);
+
+  void release(qint64 bytes);
+
+  qint64 getCurrent() const;
+  qint64 getPeak() const;
+
+private:
+  qint64 limit, current, peak;
+  mutable QMutex mutex;
+  QWaitCondition released;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_MEMORY_BUDGET_H
@@ -0,0 +1,70 @@
+#ifndef EFDL_METADATA_CACHE_H
+#define EFDL_METADATA_CACHE_H
+
+#include <QMap>
+#include <QUrl>
+#include <QString>
+#include <QDateTime>
+#include <QByteArray>
+
+#include "JsonStore.h"
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * What probing a URL found out about the remote file.
+ */
+struct ResourceInfo {
+  ResourceInfo() : size{-1}, single{true}, resumable{false} { }
+
+  // Strong entity tag or Last-Modified that If-Range can use, or empty.
+  QByteArray getValidator() const {
+    return (!etag.isEmpty() && !etag.startsWith("W/") ? etag : lastModified);
+  }
+
+  QUrl url; // after redirections
+  qint64 size;
+  QByteArray etag, lastModified;
+  QString type, filename;
+  bool single, resumable;
+  QDateTime fetched;
+};
+
+/**
+ * On-disk cache of resolved URLs and what is known about them so they
+ * do not have to be probed on every run. Entries expire after a
+ * time-to-live and are stored as JSON. Only entries with a validator
+ * of servers supporting ranges are kept, because the server must be
+ * able to confirm them with If-Range when they are used.
+ */
+class MetadataCache : public JsonStore {
+public:
+  MetadataCache();
+
+  // Location in the cache directory of the user.
+  static QString defaultPath();
+
+  void setTTL(qint64 secs) { ttl = secs; }
+  qint64 getTTL() const { return ttl; }
+
+  // Returns false if there is no entry or it has expired.
+  bool lookup(const QUrl &url, ResourceInfo &info) const;
+
+  // Info without a validator or range support removes the entry instead.
+  void insert(const QUrl &url, const ResourceInfo &info);
+  void remove(const QUrl &url);
+
+  bool load();
+  bool save();
+
+private:
+  bool isExpired(const ResourceInfo &info) const;
+
+  qint64 ttl;
+  QMap<QString, ResourceInfo> entries; // URL -> info
+};
+
+END_NAMESPACE
+
+#endif // EFDL_METADATA_CACHE_H
@@ -0,0 +1,148 @@
+#ifndef EFDL_OUTPUT_SINK_H
+#define EFDL_OUTPUT_SINK_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+
+#include <functional>
+
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Receives the downloaded data instead of a file in the output
+ * directory. write() is called on the commit thread and everything else
+ * on the thread of the downloader. Data passed to write() is only valid
+ * during the call.
+ */
+class OutputSink {
+public:
+  virtual ~OutputSink();
+
+  // Shown to the user and reported as the output path.
+  virtual QString getName() const = 0;
+
+  // Whether data can be written at any position. Otherwise it is written
+  // in order from the start.
+  virtual bool isPositional() const = 0;
+
+  // Prepares for the amount of bytes, or an unknown amount if -1.
+  virtual bool open(qint64 size) = 0;
+
+  // Memory of the opened size that connections can receive into
+  // directly, in which case write() is not called. Null if there is none.
+  virtual char *getTarget() { return nullptr; }
+
+  virtual bool write(qint64 pos, const QByteArray &data) = 0;
+
+  // Called when all data has been written.
+  virtual bool finalize() = 0;
+
+  // Called instead of finalize() when the download failed or stopped.
+  virtual void abort() = 0;
+
+  bool hasError() const { return !error.isEmpty(); }
+  QString getError() const { return error; }
+
+protected:
+  void setError(const QString &error) { this->error = error; }
+
+private:
+  QString error;
+};
+
+/**
+ * Writes to a file at any position. The file is removed if aborted.
+ */
+class FileSink : public OutputSink {
+public:
+  FileSink(const QString &path);
+
+  QString getName() const override { return file.fileName(); }
+  bool isPositional() const override { return true; }
+  bool open(qint64 size) override;
+  bool write(qint64 pos, const QByteArray &data) override;
+  bool finalize() override;
+  void abort() override;
+
+private:
+  QFile file;
+};
+
+/**
+ * Keeps the data in memory. When the size is known up front the data is
+ * received directly into it without being copied.
+ */
+class MemorySink : public OutputSink {
+public:
+  MemorySink();
+
+  QString getName() const override { return "memory"; }
+  bool isPositional() const override { return true; }
+  bool open(qint64 size) override;
+  char *getTarget() override;
+  bool write(qint64 pos, const QByteArray &data) override;
+  bool finalize() override { return true; }
+  void abort() override { data.clear(); }
+
+  QByteArray getData() const { return data; }
+
+private:
+  QByteArray data;
+  bool sized;
+};
+
+/**
+ * Writes in order to an open file descriptor, like a pipe or STDOUT.
+ * The descriptor is not closed.
+ */
+class PipeSink : public OutputSink {
+public:
+  PipeSink(int fd, const QString &name);
+
+  QString getName() const override { return name; }
+  bool isPositional() const override { return false; }
+  bool open(qint64 size) override;
+  bool write(qint64 pos, const QByteArray &data) override;
+  bool finalize() override;
+  void abort() override;
+
+private:
+  int fd;
+  QString name;
+  QFile file;
+};
+
+/**
+ * Passes the data to a function, in order unless positional. The
+ * function returns false to stop the download. The optional done
+ * function tells whether everything was passed on, and returns false
+ * if it could not finish the output.
+ */
+class CallbackSink : public OutputSink {
+public:
+  typedef std::function<bool(qint64 pos, const QByteArray &data)> Callback;
+  typedef std::function<bool(bool ok)> Done;
+
+  CallbackSink(const Callback &callback, bool positional = false);
+
+  void setDone(const Done &done) { this->done = done; }
+
+  QString getName() const override { return "callback"; }
+  bool isPositional() const override { return positional; }
+  bool open(qint64 size) override;
+  bool write(qint64 pos, const QByteArray &data) override;
+  bool finalize() override;
+  void abort() override;
+
+private:
+  Callback callback;
+  Done done;
+  bool positional;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_OUTPUT_SINK_H
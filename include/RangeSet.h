@@ -0,0 +1,49 @@
+#ifndef EFDL_RANGE_SET_H
+#define EFDL_RANGE_SET_H
+
+#include <QMap>
+#include <QList>
+
+#include "Range.h"
+#include "EfdlGlobal.h"
+
+class QDataStream;
+
+BEGIN_NAMESPACE
+
+/**
+ * Set of byte ranges of the form [start, end[ like Range. Overlapping
+ * and adjacent ranges are merged on insertion so the set stays as
+ * small as possible, and inserting or removing a range takes
+ * logarithmic time in the amount of ranges.
+ */
+class RangeSet {
+public:
+  RangeSet();
+
+  void add(const Range &range);
+  void remove(const Range &range);
+  void clear();
+
+  bool contains(qint64 pos) const;
+  bool contains(const Range &range) const;
+
+  // Ranges of [start, end[ that are not in the set.
+  QList<Range> getMissing(qint64 start, qint64 end) const;
+  QList<Range> getRanges() const;
+
+  int getCount() const { return map.size(); }
+  qint64 getBytes() const { return bytes; }
+  bool isEmpty() const { return map.isEmpty(); }
+
+private:
+  QMap<qint64, qint64> map; // start -> end
+  qint64 bytes;
+};
+
+END_NAMESPACE
+
+QDataStream &operator<<(QDataStream &stream, const EFDL_NAMESPACE::RangeSet &set);
+QDataStream &operator>>(QDataStream &stream, EFDL_NAMESPACE::RangeSet &set);
+
+#endif // EFDL_RANGE_SET_H
@@ -0,0 +1,70 @@
+#ifndef EFDL_REMOTE_FILE_H
+#define EFDL_REMOTE_FILE_H
+
+#include <QUrl>
+#include <QMap>
+#include <QCache>
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QNetworkAccessManager>
+
+#include "Range.h"
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Reads parts of a remote file through HTTP range requests without
+ * downloading all of it. Data is fetched in blocks that are kept in a
+ * least recently used cache. Missing blocks next to each other are
+ * fetched with one request, and sequential reads fetch ahead.
+ */
+class RemoteFile : public QObject {
+  Q_OBJECT
+
+public:
+  RemoteFile(const QUrl &url);
+
+  void setHttpCredentials(const QString &user, const QString &pass);
+
+  // Changing the block size clears the cache.
+  void setBlockSize(qint64 size);
+  void setCacheSize(qint64 bytes);
+
+  // Most to fetch ahead of sequential reads. 0 disables it.
+  void setMaxReadahead(qint64 bytes) { maxReadahead = bytes; }
+
+  // Resolves the URL and finds the size. Fails if the server does not
+  // support ranges. Blocks until done.
+  bool open();
+
+  QUrl getUrl() const { return url; }
+  qint64 getSize() const { return size; }
+  QString getError() const { return error; }
+
+  // Reads up to len bytes at the offset, fewer at the end of the file.
+  // Blocks until done. Returns an empty array and sets the error if it
+  // fails, for instance when the remote file changed after open().
+  QByteArray read(qint64 offset, qint64 len);
+
+  // Statistics.
+  quint64 getRequests() const { return requests; }
+  quint64 getHits() const { return hits; }
+  quint64 getMisses() const { return misses; }
+
+private:
+  bool fetch(const QList<Range> &runs, QMap<qint64, QByteArray> &blocks);
+
+  QUrl url;
+  QString httpUser, httpPass, error;
+  QByteArray validator;
+  qint64 size, blockSize, maxReadahead, readahead, lastEnd;
+  quint64 requests, hits, misses;
+  QCache<qint64, QByteArray> cache; // block number -> data
+  QNetworkAccessManager netmgr;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_REMOTE_FILE_H
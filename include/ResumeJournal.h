@@ -0,0 +1,63 @@
+#ifndef EFDL_RESUME_JOURNAL_H
+#define EFDL_RESUME_JOURNAL_H
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+
+#include "Range.h"
+#include "RangeSet.h"
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Sidecar file next to the output that keeps track of which byte
+ * ranges have been committed, together with the validators of the
+ * remote file. It is always written atomically so a crash leaves
+ * either the old or the new version on disk.
+ *
+ * Ranges are of the form [start, end[ like Range.
+ */
+class ResumeJournal {
+public:
+  ResumeJournal();
+
+  static QString pathFor(const QString &outputPath);
+
+  void setPath(const QString &path) { this->path = path; }
+  QString getPath() const { return path; }
+
+  void setContentLength(qint64 len);
+  qint64 getContentLength() const;
+
+  void setETag(const QByteArray &etag);
+  QByteArray getETag() const;
+
+  void setLastModified(const QByteArray &lastModified);
+  QByteArray getLastModified() const;
+
+  void addRange(const Range &range);
+  QList<Range> getRanges() const;
+  QList<Range> getMissing() const;
+  qint64 getBytesDone() const;
+  bool isComplete() const;
+
+  void clear();
+  bool exists() const;
+  bool load();
+  bool save();
+  bool remove();
+
+private:
+  QString path;
+  qint64 contentLen;
+  QByteArray etag, lastModified;
+  RangeSet ranges;
+  mutable QMutex mutex;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_RESUME_JOURNAL_H
@@ -1,6 +1,7 @@
 #ifndef EFDL_UTIL_H
 #define EFDL_UTIL_H
 
+#include <QFile>
 #include <QString>
 #include <QNetworkReply>
 #include <QCryptographicHash>
@@ -22,7 +23,18 @@ public:
   static QByteArray createHttpAuthHeader(const QString &user,
                                          const QString &pass);
   static QByteArray hashFile(const QString &path,
-                             const QCryptographicHash::Algorithm &alg);
+                             const QCryptographicHash::Algorithm &alg,
+                             bool dropCache = false);
+
+  // Reserves disk space for the entire file, or makes it sparse if the
+  // file system does not support that, without changing existing data.
+  static bool preallocateFile(QFile &file, qint64 size);
+
+  // Copies the file by sharing its data, with a reflink where the file
+  // system supports it or else a hard link if allowed, and otherwise by
+  // copying it. Sets linked, if given, to whether it was hard linked.
+  static bool cloneFile(const QString &src, const QString &dst,
+                        bool allowLink = false, bool *linked = nullptr);
 };
 
 END_NAMESPACE
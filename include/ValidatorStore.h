@@ -0,0 +1,51 @@
+#ifndef EFDL_VALIDATOR_STORE_H
+#define EFDL_VALIDATOR_STORE_H
+
+#include <QMap>
+#include <QUrl>
+#include <QString>
+#include <QDateTime>
+#include <QByteArray>
+
+#include "JsonStore.h"
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Remembers the validators of completed downloads, keyed by URL, so
+ * that later runs can tell whether the local copy is still current.
+ * Stored as JSON.
+ */
+class ValidatorStore : public JsonStore {
+public:
+  struct Entry {
+    Entry() : size{-1} { }
+
+    QString path; // local copy
+    qint64 size;
+    QByteArray etag, lastModified;
+    QDateTime recorded;
+  };
+
+  ValidatorStore();
+
+  // Location in the data directory of the user.
+  static QString defaultPath();
+
+  // Returns false if there is no entry or the local copy has been
+  // removed or changed size since.
+  bool lookup(const QUrl &url, Entry &entry) const;
+  void insert(const QUrl &url, const Entry &entry);
+  void remove(const QUrl &url);
+
+  bool load();
+  bool save();
+
+private:
+  QMap<QString, Entry> entries; // URL -> entry
+};
+
+END_NAMESPACE
+
+#endif // EFDL_VALIDATOR_STORE_H
@@ -0,0 +1,76 @@
+#ifndef EFDL_WRITE_BACKEND_H
+#define EFDL_WRITE_BACKEND_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QByteArray>
+
+#include "EfdlGlobal.h"
+
+class QFile;
+
+BEGIN_NAMESPACE
+
+class OutputSink;
+
+/**
+ * Performs the positional writes of the commit thread. Writes are
+ * submitted and later reaped when they have completed, which allows
+ * backends to batch them and complete them asynchronously.
+ */
+class WriteBackend {
+public:
+  enum class Type {
+    Auto,   // io_uring if supported, otherwise pwrite.
+    File,   // QFile::seek() and QFile::write().
+    Pwrite, // One pwrite() per request.
+    IoUring // Batches submitted to an io_uring (Linux only).
+  };
+
+  typedef QPair<qint64, const QByteArray*> Request; // file position -> data
+
+  virtual ~WriteBackend();
+
+  // Falls back to pwrite, or QFile where that is not available, if the
+  // requested type is not supported.
+  static WriteBackend *create(Type type, QFile *file);
+
+  // Passes the data on to the sink, which does not take ownership.
+  static WriteBackend *create(OutputSink *sink);
+  static bool stringToType(QString str, Type &type);
+
+  virtual QString getName() const = 0;
+
+  // Submits requests that are contiguous in the file as one vectored
+  // write. Data must stay valid until the requests are returned by
+  // reap().
+  virtual bool submit(const QList<Request> &group) = 0;
+
+  // Returns the requests that have completed so far, or all pending
+  // requests if wait is true.
+  virtual QList<Request> reap(bool wait) = 0;
+
+  bool hasError() const { return !error.isEmpty(); }
+  QString getError() const { return error; }
+  quint64 getSyscalls() const { return syscalls; }
+  qint64 getBytesWritten() const { return written; }
+
+protected:
+  WriteBackend(QFile *file);
+
+  // Synchronously writes a contiguous group, skipping the first bytes.
+  bool writeAll(const QList<Request> &group, qint64 skip = 0);
+  void setError(const QString &error) { this->error = error; }
+
+  QFile *file;
+  quint64 syscalls;
+  qint64 written;
+
+private:
+  QString error;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_WRITE_BACKEND_H
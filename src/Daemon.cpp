@@ -0,0 +1,240 @@
+#include <QDir>
+#include <QDebug>
+#include <QJsonDocument>
+
+#include <iostream>
+
+#include "Daemon.h"
+#include "DownloadManager.h"
+
+#include "Downloader.h"
+USE_NAMESPACE
+
+Daemon::Daemon(DownloadManager *manager, const Factory &factory)
+  : manager{manager}, factory{factory}, nextId{1}
+{
+  connect(&server, &QLocalServer::newConnection,
+          this, &Daemon::onNewConnection);
+  connect(manager, &DownloadManager::downloadStarted,
+          this, &Daemon::onDownloadStarted);
+  connect(manager, &DownloadManager::downloadProgress,
+          this, &Daemon::onDownloadProgress);
+  connect(manager, &DownloadManager::downloadFinished,
+          this, &Daemon::onDownloadFinished);
+  connect(manager, &DownloadManager::downloadFailed,
+          this, &Daemon::onDownloadFailed);
+}
+
+QString Daemon::defaultName() {
+  return "efdl";
+}
+
+bool Daemon::listen(const QString &name) {
+  // A socket left behind by a daemon that died is removed, but not one
+  // that is still in use.
+  QLocalSocket other;
+  other.connectToServer(name);
+  if (other.waitForConnected(1000)) {
+    return false;
+  }
+  QLocalServer::removeServer(name);
+
+  server.setSocketOptions(QLocalServer::UserAccessOption);
+  return server.listen(name);
+}
+
+void Daemon::onNewConnection() {
+  while (server.hasPendingConnections()) {
+    auto *client = server.nextPendingConnection();
+    connect(client, &QLocalSocket::readyRead, this, &Daemon::onReadyRead);
+    connect(client, &QLocalSocket::disconnected,
+            this, &Daemon::onDisconnected);
+  }
+}
+
+void Daemon::onReadyRead() {
+  auto *client = qobject_cast<QLocalSocket*>(sender());
+  if (!client) return;
+
+  while (client->canReadLine()) {
+    QByteArray line{client->readLine().trimmed()};
+    if (line.isEmpty()) continue;
+
+    QJsonParseError error;
+    QJsonDocument doc{QJsonDocument::fromJson(line, &error)};
+    if (!doc.isObject()) {
+      QJsonObject event;
+      event["event"] = QString("error");
+      event["error"] = "Invalid job: " + error.errorString();
+      send(client, event);
+      continue;
+    }
+    submit(client, doc.object());
+  }
+}
+
+void Daemon::onDisconnected() {
+  auto *client = qobject_cast<QLocalSocket*>(sender());
+  if (!client) return;
+
+  // Jobs of the client keep running without anyone to report to.
+  for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+    if (it->client == client) {
+      it->client = nullptr;
+    }
+  }
+  client->deleteLater();
+}
+
+void Daemon::onDownloadStarted(Downloader *downloader) {
+  QJsonObject event;
+  event["event"] = QString("started");
+  send(downloader, event, false);
+}
+
+void Daemon::onDownloadProgress(Downloader *downloader, qint64 received,
+                                qint64 total) {
+  QJsonObject event;
+  event["event"] = QString("progress");
+  event["received"] = (double) received;
+  event["total"] = (double) total;
+  send(downloader, event, false);
+}
+
+void Daemon::onDownloadFinished(Downloader *downloader,
+                                const QString &outputPath) {
+  QJsonObject event;
+  event["event"] = QString("finished");
+  event["path"] = outputPath;
+  send(downloader, event, true);
+}
+
+void Daemon::onDownloadFailed(Downloader *downloader, const QString &error) {
+  QJsonObject event;
+  event["event"] = QString("failed");
+  event["error"] = (!error.isEmpty() ? error : QString("Download failed"));
+  send(downloader, event, true);
+}
+
+void Daemon::submit(QLocalSocket *client, const QJsonObject &obj) {
+  QString url{obj["url"].toString()}, dir{obj["output"].toString()}, error;
+  Downloader *dl{nullptr};
+  if (url.isEmpty()) {
+    error = "Job has no URL";
+  }
+  else if (!dir.isEmpty() && !QDir(dir).exists()) {
+    error = "Output directory does not exist: " + dir;
+  }
+  else {
+    dl = factory(url, error);
+  }
+
+  if (!dl) {
+    QJsonObject event;
+    event["event"] = QString("error");
+    event["url"] = url;
+    event["error"] = error;
+    send(client, event);
+    return;
+  }
+
+  if (!dir.isEmpty()) {
+    dl->setOutputDir(dir);
+  }
+
+  jobs[dl] = Job{nextId++, client};
+  QJsonObject event;
+  event["event"] = QString("queued");
+  event["url"] = url;
+  send(dl, event, false);
+
+  manager->add(dl);
+}
+
+void Daemon::send(QLocalSocket *client, const QJsonObject &event) {
+  client->write(QJsonDocument{event}.toJson(QJsonDocument::Compact) + '\n');
+}
+
+void Daemon::send(Downloader *downloader, QJsonObject event, bool done) {
+  auto it = jobs.find(downloader);
+  if (it == jobs.end()) return;
+
+  event["id"] = (double) it->id;
+  if (it->client) {
+    send(it->client, event);
+  }
+  if (done) {
+    jobs.erase(it);
+  }
+}
+
+DaemonClient::DaemonClient(const QString &name, const QStringList &urls,
+                           const QString &outputDir)
+  : name{name}, outputDir{outputDir}, urls{urls}, pending{0}, failed{false}
+{
+  connect(&socket, &QLocalSocket::connected,
+          this, &DaemonClient::onConnected);
+  connect(&socket, &QLocalSocket::readyRead,
+          this, &DaemonClient::onReadyRead);
+  connect(&socket, &QLocalSocket::disconnected,
+          this, &DaemonClient::onDisconnected);
+  connect(&socket, SIGNAL(error(QLocalSocket::LocalSocketError)),
+          this, SLOT(onError(QLocalSocket::LocalSocketError)));
+}
+
+void DaemonClient::start() {
+  socket.connectToServer(name);
+}
+
+void DaemonClient::onConnected() {
+  foreach (const auto &url, urls) {
+    QJsonObject job;
+    job["url"] = url.trimmed();
+    job["output"] = outputDir;
+    socket.write(QJsonDocument{job}.toJson(QJsonDocument::Compact) + '\n');
+    pending++;
+  }
+}
+
+void DaemonClient::onReadyRead() {
+  while (socket.canReadLine()) {
+    QByteArray line{socket.readLine().trimmed()};
+    if (line.isEmpty()) continue;
+
+    // Events are passed on as they are so they can be parsed by the
+    // caller.
+    std::cout << line.constData() << std::endl;
+
+    QString event{QJsonDocument::fromJson(line).object()["event"].toString()};
+    if (event == "error" || event == "failed") {
+      failed = true;
+    }
+    else if (event != "finished") {
+      continue;
+    }
+
+    if (--pending == 0) {
+      socket.disconnectFromServer();
+      emit finished(failed ? -1 : 0);
+      return;
+    }
+  }
+}
+
+void DaemonClient::onDisconnected() {
+  if (pending > 0) {
+    qCritical() << "ERROR Daemon closed the connection!";
+    pending = 0;
+    emit finished(-1);
+  }
+}
+
+void DaemonClient::onError(QLocalSocket::LocalSocketError error) {
+  if (error == QLocalSocket::PeerClosedError) {
+    return;
+  }
+  qCritical() << "ERROR Could not connect to daemon:"
+              << qPrintable(socket.errorString());
+  pending = 0;
+  emit finished(-1);
+}
@@ -0,0 +1,103 @@
+#ifndef EFDL_DAEMON_H
+#define EFDL_DAEMON_H
+
+#include <QMap>
+#include <QObject>
+#include <QStringList>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <functional>
+
+namespace efdl {
+  class Downloader;
+}
+
+class DownloadManager;
+
+/**
+ * Accepts download jobs over a local socket and queues them with the
+ * download manager. Each job is a line of JSON like
+ * {"url": "http://..", "output": "/some/dir"}, and events about it are
+ * sent back to the client as lines of JSON.
+ */
+class Daemon : public QObject {
+  Q_OBJECT
+
+public:
+  // Creates a configured downloader for the URL, or returns null and
+  // sets the error if it is not valid.
+  typedef std::function<efdl::Downloader*(const QString &url,
+                                          QString &error)> Factory;
+
+  Daemon(DownloadManager *manager, const Factory &factory);
+
+  static QString defaultName();
+
+  // Fails if another daemon is already listening on the name.
+  bool listen(const QString &name);
+  QString getPath() const { return server.fullServerName(); }
+
+private slots:
+  void onNewConnection();
+  void onReadyRead();
+  void onDisconnected();
+
+  void onDownloadStarted(efdl::Downloader *downloader);
+  void onDownloadProgress(efdl::Downloader *downloader, qint64 received,
+                          qint64 total);
+  void onDownloadFinished(efdl::Downloader *downloader,
+                          const QString &outputPath);
+  void onDownloadFailed(efdl::Downloader *downloader, const QString &error);
+
+private:
+  struct Job {
+    qint64 id;
+    QLocalSocket *client;
+  };
+
+  void submit(QLocalSocket *client, const QJsonObject &obj);
+  void send(QLocalSocket *client, const QJsonObject &event);
+  void send(efdl::Downloader *downloader, QJsonObject event, bool done);
+
+  DownloadManager *manager;
+  Factory factory;
+  QLocalServer server;
+  qint64 nextId;
+  QMap<efdl::Downloader*, Job> jobs;
+};
+
+/**
+ * Submits URLs to a running daemon and prints the events it sends back
+ * until all of them are done.
+ */
+class DaemonClient : public QObject {
+  Q_OBJECT
+
+public:
+  DaemonClient(const QString &name, const QStringList &urls,
+               const QString &outputDir);
+
+signals:
+  // The code is zero if all downloads succeeded.
+  void finished(int code);
+
+public slots:
+  void start();
+
+private slots:
+  void onConnected();
+  void onReadyRead();
+  void onDisconnected();
+  void onError(QLocalSocket::LocalSocketError error);
+
+private:
+  QString name, outputDir;
+  QStringList urls;
+  QLocalSocket socket;
+  int pending;
+  bool failed;
+};
+
+#endif // EFDL_DAEMON_H
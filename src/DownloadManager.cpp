@@ -9,12 +9,26 @@
 
 #include "Util.h"
 #include "Downloader.h"
+#include "MemoryBudget.h"
 USE_NAMESPACE
 
+namespace {
+  // Default amount of queued downloads that are probed while the current
+  // one runs.
+  const int PREFETCH{4};
+
+  // Hosts to remember as looked up, which is about as many as Qt keeps
+  // the results of.
+  const int MAX_HOSTS{128};
+}
+
 DownloadManager::DownloadManager(bool dryRun, bool connProg)
-  : dryRun{dryRun}, connProg{connProg}, chksum{false}, conns{0},
-  chunksAmount{0}, chunksFinished{0}, size{0}, offset{0}, bytesDown{0},
-  hashAlg{QCryptographicHash::Sha3_512}, downloader{nullptr}
+  : dryRun{dryRun}, connProg{connProg}, chksum{false}, dropCache{false},
+  noTransfer{false}, keepGoing{false}, idle{false}, progressOnStderr{false},
+  sourceDone{false}, conns{0}, prefetchCount{PREFETCH}, chunksAmount{0},
+  chunksFinished{0}, size{0}, offset{0}, bytesDown{0},
+  hashAlg{QCryptographicHash::Sha3_512}, downloader{nullptr},
+  memoryBudget{nullptr}
 { }
 
 DownloadManager::~DownloadManager() {
@@ -23,7 +37,10 @@ DownloadManager::~DownloadManager() {
 }
 
 void DownloadManager::add(Downloader *entry) {
-  queue << entry;
+  enqueue(entry);
+  if (idle) {
+    next();
+  }
 }
 
 void DownloadManager::setVerifcations(const QList<HashPair> &pairs) {
@@ -39,43 +56,54 @@ void DownloadManager::start() {
   next();
 }
 
-void DownloadManager::next() {
-  static bool first{true};
-  if (!first) {
-    if (!dryRun) {
-      // Update progress with total download time with no connection
-      // lines.
-      bool tmp{connProg};
-      connProg = false;
-      lastProgress = QDateTime(); // Force update.
-      updateProgress();
-      connProg = tmp;
-
-      if (!verifyList.isEmpty()) {
-        verifyIntegrity(verifyList.takeFirst());
-      }
-
-      if (chksum) printChecksum();
-    }
+void DownloadManager::sourceReady() {
+  if (idle) {
+    next();
+    return;
+  }
+  fill();
+  prefetch();
+}
 
-    // Separate each download with a newline.
-    if (!queue.isEmpty()) qDebug();
+void DownloadManager::sourceEnded() {
+  sourceDone = true;
+  if (idle) {
+    next();
   }
-  if (first) first = false;
-  
+}
+
+void DownloadManager::next() {
+  fill();
   if (queue.isEmpty()) {
-    emit finished();
+    idle = true;
+
+    // More might still come from the source.
+    if (!source) {
+      emit finished();
+    }
     return;
   }
+  idle = false;
 
   cleanup();
 
   downloader = queue.dequeue();
   qDebug() << "Downloading"
            << qPrintable(downloader->getUrl().toString(QUrl::FullyEncoded));
-  connect(downloader, &Downloader::finished, this, &DownloadManager::next);
+  connect(downloader, &Downloader::finished,
+          this, &DownloadManager::onFinished);
+
+  // Let the downloader hash the data if it has it in memory anyway.
+  QList<QCryptographicHash::Algorithm> algs;
+  if (!dryRun && !verifyList.isEmpty()) algs << verifyList.first().first;
+  if (!dryRun && chksum) algs << hashAlg;
+  downloader->setHashes(algs);
+
+  connect(downloader, &Downloader::failed, this, &DownloadManager::onFailed);
   connect(downloader, &Downloader::information,
           this, &DownloadManager::onInformation);
+  connect(downloader, &Downloader::completedLocally,
+          this, &DownloadManager::onCompletedLocally);
   connect(downloader, &Downloader::chunkStarted,
           this, &DownloadManager::onChunkStarted);
   connect(downloader, &Downloader::chunkProgress,
@@ -84,30 +112,125 @@ void DownloadManager::next() {
           this, &DownloadManager::onChunkFinished);
   connect(downloader, &Downloader::chunkFailed,
           this, &DownloadManager::onChunkFailed);
-  downloader->start();
 
+  // The download might finish while starting if nothing has to be
+  // transferred.
   started = QDateTime::currentDateTime();
+  emit downloadStarted(downloader);
+  downloader->start();
+
+  prefetch();
+}
+
+void DownloadManager::onFinished() {
+  if (!dryRun) {
+    // Update progress with total download time with no connection
+    // lines. Files completed locally were not transferred.
+    if (!noTransfer) {
+      bool tmp{connProg};
+      connProg = false;
+      lastProgress = QDateTime(); // Force update.
+      updateProgress();
+      connProg = tmp;
+    }
+
+    if (!verifyList.isEmpty()) {
+      verifyIntegrity(verifyList.takeFirst());
+    }
+
+    if (chksum) printChecksum();
+  }
+  emit downloadFinished(downloader, outputPath);
+
+  // Separate each download with a newline.
+  fill();
+  if (!queue.isEmpty()) qDebug();
+
+  next();
+}
+
+void DownloadManager::onFailed(const QString &error) {
+  abort(error);
+}
+
+void DownloadManager::enqueue(Downloader *entry) {
+  queue << entry;
+
+  // Look up hosts up front. The results are cached by Qt so later
+  // connections to them skip the lookup. Hosts are forgotten once there
+  // are too many, so they are looked up again after Qt evicted them.
+  QString host{entry->getUrl().host()};
+  if (hosts.contains(host)) {
+    return;
+  }
+  if (hosts.size() >= MAX_HOSTS) {
+    hosts.clear();
+  }
+  hosts << host;
+  QHostInfo::lookupHost(host, this, SLOT(onHostLookedUp(QHostInfo)));
+}
+
+void DownloadManager::fill() {
+  // Enough for the next download and the ones probed ahead of it.
+  while (source && queue.size() <= prefetchCount) {
+    auto *dl = source();
+    if (!dl) {
+      // Wait for sourceReady() unless there will be no more.
+      if (sourceDone) {
+        source = nullptr;
+      }
+      break;
+    }
+    enqueue(dl);
+  }
+}
+
+void DownloadManager::prefetch() {
+  // Keep the next few downloads resolved so they can start right away.
+  // The window moves on with every download that is started.
+  int i{0};
+  foreach (auto *dl, queue) {
+    if (i++ >= prefetchCount) break;
+    dl->probe();
+  }
+}
+
+void DownloadManager::onHostLookedUp(const QHostInfo &info) {
+  Q_UNUSED(info);
 }
 
 void DownloadManager::onInformation(const QString &outputPath, qint64 size,
-                                    int chunksAmount, int conns,
+                                    qint64 chunksAmount, int conns,
                                     qint64 offset) {
   this->outputPath = outputPath;
   this->size = size;
   this->chunksAmount = chunksAmount;
   this->conns = conns;
   this->offset = offset;
+
+  // A download that starts over reports again from the beginning.
+  {
+    QMutexLocker locker{&chunkMutex};
+    chunksFinished = bytesDown = 0;
+    qDeleteAll(chunkMap);
+    chunkMap.clear();
+  }
   updateProgress();
 }
 
-void DownloadManager::onChunkStarted(int num) {
+void DownloadManager::onCompletedLocally(const QString &outputPath) {
+  this->outputPath = outputPath;
+  noTransfer = true;
+}
+
+void DownloadManager::onChunkStarted(qint64 num) {
   QMutexLocker locker{&chunkMutex};
   chunkMap[num] = new Chunk{Range{0, 0}, QDateTime::currentDateTime()};
   updateChunkMap();
   updateProgress();
 }
 
-void DownloadManager::onChunkProgress(int num, qint64 received, qint64 total) {
+void DownloadManager::onChunkProgress(qint64 num, qint64 received, qint64 total) {
   QMutexLocker locker{&chunkMutex};
   Chunk *chunk = chunkMap[num];
   bytesDown += received - chunk->range.first;
@@ -122,33 +245,53 @@ void DownloadManager::onChunkProgress(int num, qint64 received, qint64 total) {
   updateProgress();
 }
 
-void DownloadManager::onChunkFinished(int num, Range range) {
+void DownloadManager::onChunkFinished(qint64 num, Range range) {
   QMutexLocker locker{&chunkMutex};
   chunksFinished++;
   updateChunkMap();
   updateProgress();
 }
 
-void DownloadManager::onChunkFailed(int num, Range range, int httpCode,
+void DownloadManager::onChunkFailed(qint64 num, Range range, int httpCode,
                                     QNetworkReply::NetworkError error) {
-  QMutexLocker locker{&chunkMutex};
-  qCritical() << "Chunk" << num << "failed on range" << range;
-  qCritical() << "HTTP code:" << httpCode;
-  qCritical() << "Error:" << qPrintable(Util::getErrorString(error));
-  qCritical() << "Aborting..";
+  {
+    QMutexLocker locker{&chunkMutex};
+    qCritical() << "Chunk" << num << "failed on range" << range;
+    qCritical() << "HTTP code:" << httpCode;
+    qCritical() << "Error:" << qPrintable(Util::getErrorString(error));
+    qCritical() << "Aborting..";
+  }
 
-  cleanup();
-  QCoreApplication::exit(-1);
+  abort(QString("Chunk %1 failed with HTTP code %2: %3").arg(num)
+        .arg(httpCode).arg(Util::getErrorString(error)));
+}
+
+void DownloadManager::abort(const QString &error) {
+  emit downloadFailed(downloader, error);
+  if (!keepGoing) {
+    cleanup();
+    QCoreApplication::exit(-1);
+    return;
+  }
+
+  // Keep verification pairs in line with the downloads.
+  if (!verifyList.isEmpty()) {
+    verifyList.removeFirst();
+  }
+  next();
 }
 
 void DownloadManager::cleanup() {
   if (downloader) {
+    // Ignore anything it emits while being stopped.
+    downloader->disconnect(this);
     downloader->stop(); // waits
     downloader->deleteLater();
     downloader = nullptr;
   }
 
   chunksAmount = chunksFinished = size = offset = bytesDown = 0;
+  noTransfer = false;
 
   qDeleteAll(chunkMap);
   chunkMap.clear();
@@ -191,6 +334,7 @@ void DownloadManager::updateProgress() {
     return;
   }
   lastProgress = now;
+  emit downloadProgress(downloader, bytesDown + offset, size);
 
   using namespace std;
   stringstream sstream;
@@ -240,10 +384,18 @@ void DownloadManager::updateProgress() {
             << (!done ? "left" : "total");
   }
 
+  if (memoryBudget && memoryBudget->getLimit() != -1) {
+    sstream << " | mem "
+            << Util::formatSize(memoryBudget->getCurrent(), 1).toStdString()
+            << " (peak "
+            << Util::formatSize(memoryBudget->getPeak(), 1).toStdString()
+            << ")";
+  }
+
   sstream << " ]";
 
   if (connProg) {
-    foreach (const int &num, chunkMap.keys()) {
+    foreach (const qint64 &num, chunkMap.keys()) {
       auto *chunk = chunkMap[num];
       qint64 received = chunk->range.first, total = chunk->range.second;
 
@@ -286,22 +438,28 @@ void DownloadManager::updateProgress() {
   static int lastLines{0};
   string msg{sstream.str()};
 
+  // Standard output might be taken by the downloaded data.
+  ostream &out = (progressOnStderr ? cerr : cout);
+
   // Remove additional lines, if any.
   for (int i = 0; i < lastLines; i++) {
-    cout << "\033[A" // Go up a line (\033 = ESC, [ = CTRL).
-         << "\033[2K"; // Kill line.
+    out << "\033[A" // Go up a line (\033 = ESC, [ = CTRL).
+        << "\033[2K"; // Kill line.
   }
 
   // Rewind to beginning with carriage return and write actual
   // message.
-  cout << '\r' << msg;
-  cout.flush();
+  out << '\r' << msg;
+  out.flush();
 
   lastLines = QString(msg.c_str()).split("\n").size() - 1;
 }
 
 void DownloadManager::verifyIntegrity(const HashPair &pair) {
-  QString hash{Util::hashFile(outputPath, pair.first)};
+  QString hash{downloader->getHash(pair.first)};
+  if (hash.isEmpty()) {
+    hash = Util::hashFile(outputPath, pair.first, dropCache);
+  }
   if (hash.isEmpty()) return;
   if (hash == pair.second) {
     qDebug() << "\033[1;32mVerified:\033[0;37m" << qPrintable(pair.second);
@@ -314,7 +472,10 @@ void DownloadManager::verifyIntegrity(const HashPair &pair) {
 }
 
 void DownloadManager::printChecksum() {
-  QByteArray hash{Util::hashFile(outputPath, hashAlg)};
+  QByteArray hash{downloader->getHash(hashAlg)};
+  if (hash.isEmpty()) {
+    hash = Util::hashFile(outputPath, hashAlg, dropCache);
+  }
   if (hash.isEmpty()) return;
   qDebug() << "Checksum:" << qPrintable(hash);
 }
@@ -1,17 +1,22 @@
 #ifndef EFDL_DOWNLOAD_MANAGER_H
 #define EFDL_DOWNLOAD_MANAGER_H
 
+#include <QSet>
 #include <QQueue>
 #include <QMutex>
 #include <QObject>
 #include <QDateTime>
+#include <QHostInfo>
 #include <QNetworkReply>
 #include <QCryptographicHash>
 
+#include <functional>
+
 #include "Range.h"
 
 namespace efdl {
   class Downloader;
+  class MemoryBudget;
 }
 
 class Chunk {
@@ -34,32 +39,74 @@ class DownloadManager : public QObject {
   Q_OBJECT
   
 public:
+  // Returns the next downloader, or null when there is none yet.
+  typedef std::function<efdl::Downloader*()> Source;
+
   DownloadManager(bool dryRun = false, bool connProg = false);
   ~DownloadManager();
 
+  // Downloads added after the queue ran empty are started right away.
   void add(efdl::Downloader *entry);
 
+  // Downloaders are taken from the source after the added ones, and only
+  // a few at a time so memory stays the same however many it has. The
+  // manager waits for the source until sourceEnded().
+  void setSource(const Source &source) { this->source = source; }
+
   void setVerifcations(const QList<HashPair> &pairs);
   void createChecksum(QCryptographicHash::Algorithm hashAlg);
+  void setDropCache(bool drop) { dropCache = drop; }
+  void setMemoryBudget(efdl::MemoryBudget *budget) { memoryBudget = budget; }
+
+  // Amount of queued downloads that are probed while the current one
+  // runs. Small files are downloaded entirely while probing.
+  void setPrefetch(int count) { prefetchCount = count; }
+
+  void setProgressOnStderr(bool on) { progressOnStderr = on; }
+
+  // Continue with the next download when one fails instead of exiting.
+  void setKeepGoing(bool keepGoing) { this->keepGoing = keepGoing; }
 
 signals:
   void finished();
+
+  // Signals for individual downloads.
+  void downloadStarted(efdl::Downloader *downloader);
+  void downloadProgress(efdl::Downloader *downloader, qint64 received,
+                        qint64 total);
+  void downloadFinished(efdl::Downloader *downloader,
+                        const QString &outputPath);
+  void downloadFailed(efdl::Downloader *downloader, const QString &error);
                                          
 public slots:
   void start();
 
+  // The source has more downloaders after returning none.
+  void sourceReady();
+
+  // The source has no more downloaders than it returns now.
+  void sourceEnded();
+
 private slots:
   void next();
-
-  void onInformation(const QString &outputPath, qint64 size, int chunksAmount,
-                     int conns, qint64 offset);
-  void onChunkStarted(int num);
-  void onChunkProgress(int num, qint64 received, qint64 total);
-  void onChunkFinished(int num, efdl::Range range);
-  void onChunkFailed(int num, efdl::Range range, int httpCode,
+  void prefetch();
+  void onFinished();
+  void onFailed(const QString &error);
+  void onHostLookedUp(const QHostInfo &info);
+  void onCompletedLocally(const QString &outputPath);
+
+  void onInformation(const QString &outputPath, qint64 size,
+                     qint64 chunksAmount, int conns, qint64 offset);
+  void onChunkStarted(qint64 num);
+  void onChunkProgress(qint64 num, qint64 received, qint64 total);
+  void onChunkFinished(qint64 num, efdl::Range range);
+  void onChunkFailed(qint64 num, efdl::Range range, int httpCode,
                      QNetworkReply::NetworkError error);
 
 private:
+  void enqueue(efdl::Downloader *entry);
+  void fill();
+  void abort(const QString &error);
   void cleanup();
   void updateChunkMap();
   void updateProgress();
@@ -67,17 +114,22 @@ private:
   void printChecksum();
 
   QQueue<efdl::Downloader*> queue;
+  Source source;
+  QSet<QString> hosts; // looked up recently
 
-  bool dryRun, connProg, chksum;
+  bool dryRun, connProg, chksum, dropCache, noTransfer, keepGoing, idle,
+    progressOnStderr, sourceDone;
   QString outputPath;
-  int conns, chunksAmount, chunksFinished;
+  int conns, prefetchCount;
+  qint64 chunksAmount, chunksFinished;
   qint64 size, offset, bytesDown;
   QDateTime started, lastProgress;
   QList<HashPair> verifyList;
   QCryptographicHash::Algorithm hashAlg;
   efdl::Downloader *downloader;
+  efdl::MemoryBudget *memoryBudget;
   QMutex chunkMutex;
-  QMap<int, Chunk*> chunkMap; // num -> download progress
+  QMap<qint64, Chunk*> chunkMap; // num -> download progress
 };
 
 #endif // EFDL_DOWNLOAD_MANAGER_H
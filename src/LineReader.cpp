@@ -0,0 +1,42 @@
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include "LineReader.h"
+
+namespace {
+  const int MAX_LINES{1024};
+}
+
+LineReader::LineReader(FILE *file) : file{file}, free{MAX_LINES} { }
+
+QString LineReader::takeLine() {
+  QMutexLocker locker{&mutex};
+  if (lines.isEmpty()) {
+    return QString();
+  }
+  free.release();
+  return lines.dequeue();
+}
+
+void LineReader::run() {
+  QTextStream input{file, QIODevice::ReadOnly};
+  for (;;) {
+    QString line{input.readLine()};
+    if (line.isNull()) {
+      break;
+    }
+    line = line.trimmed();
+    if (line.isEmpty()) continue;
+
+    free.acquire();
+    bool wasEmpty;
+    {
+      QMutexLocker locker{&mutex};
+      wasEmpty = lines.isEmpty();
+      lines.enqueue(line);
+    }
+    if (wasEmpty) {
+      emit readyRead();
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef EFDL_LINE_READER_H
+#define EFDL_LINE_READER_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QSemaphore>
+
+#include <cstdio>
+
+/**
+ * Reads lines from a file, like STDIN, on a thread of its own so the
+ * event loop is never blocked waiting for them. At most a limited amount
+ * of lines is kept until they are taken, after which reading waits.
+ * Empty lines are skipped and the thread finishes at the end of the file.
+ */
+class LineReader : public QThread {
+  Q_OBJECT
+
+public:
+  LineReader(FILE *file);
+
+  // Returns the next line read so far, or a null string if there is none
+  // yet.
+  QString takeLine();
+
+signals:
+  // Lines can be taken after none could.
+  void readyRead();
+
+protected:
+  void run() override;
+
+private:
+  FILE *file;
+  QQueue<QString> lines;
+  QMutex mutex;
+  QSemaphore free;
+};
+
+#endif // EFDL_LINE_READER_H
@@ -0,0 +1,92 @@
+#include <QMutexLocker>
+
+#include "BufferPool.h"
+
+namespace {
+  const int MIN_CLASS{16}; // 64 KB
+  const int MAX_CLASS{30}; // 1 GB
+}
+
+BEGIN_NAMESPACE
+
+BufferPool::BufferPool()
+  : maxIdle{4}, hits{0}, misses{0}, bytes{0}, peakBytes{0}
+{ }
+
+BufferPool::~BufferPool() {
+  foreach (const auto &list, idle) {
+    qDeleteAll(list);
+  }
+}
+
+QByteArray *BufferPool::acquire(qint64 size) {
+  int cls{sizeClass(size)};
+  {
+    QMutexLocker locker{&mutex};
+    auto it = idle.find(cls);
+    if (it != idle.end() && !it->isEmpty()) {
+      hits++;
+      return it->takeLast();
+    }
+    misses++;
+  }
+
+  // Reserving marks the capacity as reserved which makes resize(0) keep
+  // the memory when the buffer is recycled.
+  auto *buffer = new QByteArray;
+  buffer->reserve(cls > MAX_CLASS ? int(size) : (1 << cls));
+
+  QMutexLocker locker{&mutex};
+  bytes += buffer->capacity();
+  peakBytes = qMax(peakBytes, bytes);
+  return buffer;
+}
+
+void BufferPool::release(QByteArray *buffer) {
+  if (!buffer) return;
+
+  int cls{-1};
+  int capacity{buffer->capacity()};
+  if (capacity >= (1 << MIN_CLASS)) {
+    cls = MIN_CLASS;
+    while (cls < MAX_CLASS && (1 << (cls + 1)) <= capacity) {
+      cls++;
+    }
+  }
+
+  {
+    QMutexLocker locker{&mutex};
+    if (cls != -1 && idle[cls].size() < maxIdle) {
+      buffer->resize(0);
+      idle[cls] << buffer;
+      return;
+    }
+    bytes -= capacity;
+  }
+  delete buffer;
+}
+
+quint64 BufferPool::getHits() const {
+  QMutexLocker locker{&mutex};
+  return hits;
+}
+
+quint64 BufferPool::getMisses() const {
+  QMutexLocker locker{&mutex};
+  return misses;
+}
+
+qint64 BufferPool::getPeakBytes() const {
+  QMutexLocker locker{&mutex};
+  return peakBytes;
+}
+
+int BufferPool::sizeClass(qint64 size) {
+  int cls{MIN_CLASS};
+  while (cls <= MAX_CLASS && (qint64(1) << cls) < size) {
+    cls++;
+  }
+  return cls;
+}
+
+END_NAMESPACE
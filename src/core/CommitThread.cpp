@@ -1,23 +1,67 @@
 #include <QDebug>
 #include <QDateTime>
 
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+  #include <fcntl.h> // sync_file_range(), posix_fadvise()
+#elif defined(Q_OS_MAC)
+  #include <fcntl.h> // fcntl()
+#endif
+
+#ifdef WIN32
+  #include <io.h> // _get_osfhandle()
+  #include <windows.h> // FlushFileBuffers()
+#else
+  #include <unistd.h> // fdatasync(), fsync()
+#endif
+
+#include "BufferPool.h"
 #include "CommitThread.h"
+#include "MemoryBudget.h"
+#include "ResumeJournal.h"
 
 BEGIN_NAMESPACE
 
-CommitThread::CommitThread() : file{nullptr}, last{false} { }
+CommitThread::CommitThread()
+  : file{nullptr}, sink{nullptr}, journal{nullptr}, backend{nullptr},
+    bufferPool{nullptr}, memoryBudget{nullptr},
+    backendType{WriteBackend::Type::Auto}, last{false}, dropCache{false},
+    mapped{false}, ordered{false}, coalesceSize{4194304}, queuedBytes{0},
+    syncBytes{0}, syncInterval{0}, syncs{0}, writebackBytes{0}, streamPos{0},
+    syscalls{0}, bytesWritten{0}, elapsed{0}
+{ }
 
 CommitThread::~CommitThread() {
   cleanup();
 }
 
-void CommitThread::enqueueChunk(const QByteArray *data, bool last) {
+void CommitThread::enqueueChunk(qint64 pos, const QByteArray *data, bool last) {
   QMutexLocker locker(&queueMutex);
   this->last = last;
-  queue.enqueue(data);
+  if (queue.isEmpty()) {
+    firstQueued = QDateTime::currentDateTime();
+  }
+  queue.enqueue(qMakePair(pos, data));
+  queuedBytes += data->size();
 }
 
 void CommitThread::run() {
+  started = lastSync = QDateTime::currentDateTime();
+  error.clear();
+  syncs = 0;
+  streamPos = 0;
+  backend = (sink ? WriteBackend::create(sink)
+             : WriteBackend::create(backendType, file));
+  backendName = backend->getName();
+
+#ifdef Q_OS_MAC
+  // There is no fadvise so bypass the unified buffer cache instead.
+  if (dropCache && file) {
+    fcntl(file->handle(), F_NOCACHE, 1);
+  }
+#endif
+
   QDateTime lastTime{QDateTime::currentDateTime()};
   for (;;) {
     // Only check for interrupt every half second.
@@ -29,44 +73,289 @@ void CommitThread::run() {
       lastTime = now;
     }
 
-    const QByteArray *data{nullptr};
-    int amountLeft = 0;
+    // Take everything that is queued so the backend can submit it as
+    // one batch, but give small chunks a moment to accumulate so they
+    // can be coalesced.
+    constexpr qint64 FLUSH_INTERVAL{50}; // ms
+    QList<WriteBackend::Request> batch;
+    bool done;
     {
       QMutexLocker locker(&queueMutex);
-      if (!queue.isEmpty()) {
-        data = queue.dequeue();
+      done = last;
+      if (done || queuedBytes >= coalesceSize ||
+          firstQueued.msecsTo(now) >= FLUSH_INTERVAL) {
+        while (!queue.isEmpty()) {
+          batch << queue.dequeue();
+        }
+        queuedBytes = 0;
       }
-      amountLeft = queue.size();
     }
-    if (!data) {
-      msleep(10);
-      continue;
+
+    if (ordered) {
+      batch = reorder(batch);
+    }
+    foreach (const auto &request, batch) {
+      pending.insert(request.second);
     }
 
-    qint64 wrote;
-    if ((wrote = file->write(*data)) != data->size()) {
-      qCritical() << "ERROR Could not write the entire data:"
-                  << wrote << "of" << data->size();
-      // TODO: handle this in a different way!
-      return;
+    if (mapped) {
+      commit(batch);
     }
-    delete data;
+    else {
+      submit(batch);
+    }
+
+    // Wait for pending writes when idle or done.
+    commit(backend->reap(batch.isEmpty() || done));
+    if (backend->hasError()) {
+      error = backend->getError();
+      qCritical() << "ERROR Could not write data:" << qPrintable(error);
+      break;
+    }
+    checkpoint();
 
-    if (last && amountLeft == 0) {
+    if (done) {
       break;
     }
-    msleep(10);
+    if (batch.isEmpty()) {
+      msleep(10);
+    }
   }
 
   cleanup();
 }
 
+void CommitThread::reset() {
+  cleanup();
+  unsynced.clear();
+
+  QMutexLocker locker(&queueMutex);
+  last = false;
+  queuedBytes = 0;
+}
+
 void CommitThread::cleanup() {
+  if (backend) {
+    commit(backend->reap(true));
+    evict(0);
+    syscalls = backend->getSyscalls();
+    bytesWritten = backend->getBytesWritten();
+    elapsed = started.msecsTo(QDateTime::currentDateTime());
+    delete backend;
+    backend = nullptr;
+  }
+
+  // Data of writes that failed or were never submitted.
+  foreach (const auto *data, pending) {
+    release(data);
+  }
+  pending.clear();
+
+  {
+    QMutexLocker locker(&queueMutex);
+    while (!queue.isEmpty()) {
+      release(queue.dequeue().second);
+    }
+  }
+  foreach (const auto *data, held) {
+    release(data);
+  }
+  held.clear();
+
   if (file) {
+    checkpoint(true);
     file->close();
     delete file;
     file = nullptr;
   }
 }
 
+QList<WriteBackend::Request>
+CommitThread::reorder(const QList<WriteBackend::Request> &batch) {
+  // Empty data could share its position with the chunk after it.
+  foreach (const auto &request, batch) {
+    if (request.second->isEmpty()) {
+      release(request.second);
+      continue;
+    }
+    held.insert(request.first, request.second);
+  }
+
+  // Pass on what continues where the stream is at.
+  QList<WriteBackend::Request> ready;
+  while (!held.isEmpty() && held.firstKey() == streamPos) {
+    const auto *data = held.take(streamPos);
+    ready << qMakePair(streamPos, data);
+    streamPos += data->size();
+  }
+  if (!ready.isEmpty()) {
+    emit streamed(streamPos);
+  }
+  return ready;
+}
+
+bool CommitThread::submit(QList<WriteBackend::Request> batch) {
+  std::sort(batch.begin(), batch.end(),
+            [](const WriteBackend::Request &a, const WriteBackend::Request &b) {
+              return a.first < b.first;
+            });
+
+  // Group chunks that are adjacent in the file into vectored writes.
+  constexpr int MAX_GROUP{64};
+  QList<WriteBackend::Request> group;
+  qint64 groupEnd{0}, groupBytes{0};
+  foreach (const auto &request, batch) {
+    qint64 size{request.second->size()};
+    if (!group.isEmpty() &&
+        (request.first != groupEnd || groupBytes + size > coalesceSize ||
+         group.size() >= MAX_GROUP)) {
+      if (!backend->submit(group)) {
+        return false;
+      }
+      group.clear();
+      groupBytes = 0;
+    }
+    group << request;
+    groupEnd = request.first + size;
+    groupBytes += size;
+  }
+  if (!group.isEmpty()) {
+    return backend->submit(group);
+  }
+  return true;
+}
+
+void CommitThread::commit(const QList<WriteBackend::Request> &requests) {
+  foreach (const auto &request, requests) {
+    const auto *data = request.second;
+    pending.remove(data);
+    Range range{request.first, request.first + data->size()};
+    if (syncBytes > 0 || syncInterval > 0) {
+      unsynced.add(range);
+    }
+    else if (journal) {
+      journal->addRange(range);
+    }
+    if (dropCache && file) {
+      writeBack(range);
+    }
+    release(data);
+  }
+}
+
+void CommitThread::release(const QByteArray *data) {
+  // Only a view of the mapping that is not accounted for anywhere.
+  if (mapped) {
+    delete data;
+    return;
+  }
+
+  if (memoryBudget) {
+    memoryBudget->release(data->size());
+  }
+  if (bufferPool) {
+    bufferPool->release(const_cast<QByteArray*>(data));
+  }
+  else {
+    delete data;
+  }
+}
+
+void CommitThread::writeBack(const Range &range) {
+#ifdef Q_OS_LINUX
+  // Start writing the range back asynchronously and evict older ranges
+  // from the page cache once more than the window is pending.
+  constexpr qint64 WINDOW{33554432}; // 32 MB
+
+  file->flush();
+  sync_file_range(file->handle(), range.first, range.second - range.first,
+                  SYNC_FILE_RANGE_WRITE);
+  writeback.enqueue(range);
+  writebackBytes += range.second - range.first;
+  evict(WINDOW);
+#else
+  Q_UNUSED(range);
+#endif
+}
+
+void CommitThread::evict(qint64 maxPending) {
+#ifdef Q_OS_LINUX
+  while (!writeback.isEmpty() && writebackBytes > maxPending) {
+    auto range = writeback.dequeue();
+    qint64 len{range.second - range.first};
+    writebackBytes -= len;
+
+    // Pages must be clean before they can be dropped.
+    sync_file_range(file->handle(), range.first, len,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(file->handle(), range.first, len, POSIX_FADV_DONTNEED);
+  }
+#else
+  Q_UNUSED(maxPending);
+#endif
+}
+
+void CommitThread::checkpoint(bool force) {
+  QDateTime now{QDateTime::currentDateTime()};
+
+  // With a sync policy the journal only ever claims ranges that are on
+  // disk, so it is saved right after each sync.
+  if (syncBytes > 0 || syncInterval > 0) {
+    bool due{force || (syncBytes > 0 && unsynced.getBytes() >= syncBytes) ||
+        (syncInterval > 0 && lastSync.secsTo(now) >= syncInterval)};
+    if (!due || unsynced.isEmpty()) {
+      return;
+    }
+    lastSync = now;
+    if (!syncFile()) {
+      qWarning() << "WARN Could not sync output file to disk!";
+      return;
+    }
+    if (journal) {
+      foreach (const auto &range, unsynced.getRanges()) {
+        journal->addRange(range);
+      }
+    }
+    unsynced.clear();
+  }
+
+  // Saving the journal is relatively expensive so only do it once a
+  // second unless forced.
+  else {
+    if (!force && !lastSave.isNull() && lastSave.msecsTo(now) < 1000) {
+      return;
+    }
+    lastSave = now;
+
+    // Make sure the data reaches the OS before the journal claims it.
+    if (file) file->flush();
+  }
+
+  if (journal && !journal->save()) {
+    qWarning() << "WARN Could not save resume journal:"
+               << qPrintable(journal->getPath());
+  }
+}
+
+bool CommitThread::syncFile() {
+  if (!file || !file->flush()) {
+    return false;
+  }
+  syncs++;
+
+  // Only the data and the size are needed to trust the journal so skip
+  // the other metadata where possible.
+#if defined(Q_OS_LINUX)
+  return fdatasync(file->handle()) == 0;
+#elif defined(Q_OS_MAC)
+  return fcntl(file->handle(), F_FULLFSYNC) != -1;
+#elif !defined(WIN32)
+  return fsync(file->handle()) == 0;
+#else
+  auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(file->handle()));
+  return handle != INVALID_HANDLE_VALUE && FlushFileBuffers(handle);
+#endif
+}
+
 END_NAMESPACE
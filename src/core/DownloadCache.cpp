@@ -0,0 +1,225 @@
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+
+#include "Util.h"
+#include "DownloadCache.h"
+
+namespace {
+  const int VERSION{1};
+  const int LOCK_TIMEOUT{30000}; // ms
+}
+
+BEGIN_NAMESPACE
+
+DownloadCache::DownloadCache() : maxSize{-1}, allowLinks{false} { }
+
+bool DownloadCache::fetch(const QUrl &url, const QByteArray &etag,
+                          const QString &path) {
+  if (etag.isEmpty() || etag.startsWith("W/")) {
+    return false;
+  }
+
+  QLockFile lock{QDir{dir}.absoluteFilePath("lock")};
+  lock.setStaleLockTime(0);
+  if (!lock.tryLock(LOCK_TIMEOUT) || !loadIndex()) {
+    return false;
+  }
+
+  QString hash{keys.value(key(url, etag))};
+  if (hash.isEmpty() || !objects.contains(hash)) {
+    return false;
+  }
+
+  // Objects are read-only so hard links to them cannot change the
+  // cached data in place, but copies are the user's to change.
+  QString src{objectPath(hash)};
+  bool linked{false};
+  if (QFileInfo(src).size() != objects[hash].size ||
+      !Util::cloneFile(src, path, allowLinks, &linked)) {
+    return false;
+  }
+  if (!linked) {
+    QFile::setPermissions(path, QFile::permissions(path) | QFile::WriteOwner |
+                          QFile::WriteUser);
+  }
+
+  objects[hash].used = QDateTime::currentDateTime();
+  saveIndex();
+  return true;
+}
+
+bool DownloadCache::store(const QUrl &url, const QByteArray &etag,
+                          const QString &path) {
+  if (etag.isEmpty() || etag.startsWith("W/")) {
+    return false;
+  }
+
+  // Hash before locking so other processes are not held up.
+  QString hash{
+    QString::fromUtf8(Util::hashFile(path, QCryptographicHash::Sha256))};
+  if (hash.isEmpty()) {
+    return false;
+  }
+
+  // Copying can take long so it is done before locking, under a name
+  // of this process, unless the content is cached already.
+  QDir().mkpath(QDir{dir}.absoluteFilePath("objects"));
+  QString dst{objectPath(hash)}, tmp;
+  if (!QFile::exists(dst)) {
+    tmp = QString("%1.%2.tmp").arg(dst)
+      .arg(QCoreApplication::applicationPid());
+    if (!Util::cloneFile(path, tmp)) {
+      QFile::remove(tmp);
+      return false;
+    }
+  }
+
+  // Locks are held while copying out of the cache, so they are only
+  // stale if the owning process is gone.
+  QLockFile lock{QDir{dir}.absoluteFilePath("lock")};
+  lock.setStaleLockTime(0);
+  if (!lock.tryLock(LOCK_TIMEOUT)) {
+    if (!tmp.isEmpty()) {
+      QFile::remove(tmp);
+    }
+    return false;
+  }
+  loadIndex();
+
+  // Another process might have stored the same content meanwhile, or
+  // evicted it since it was found.
+  if (!tmp.isEmpty()) {
+    if (QFile::exists(dst) || !QFile::rename(tmp, dst)) {
+      QFile::remove(tmp);
+    }
+    else {
+      QFile::setPermissions(dst, QFile::ReadOwner | QFile::ReadGroup |
+                            QFile::ReadOther);
+    }
+  }
+  if (!QFile::exists(dst)) {
+    return false;
+  }
+  if (!objects.contains(hash)) {
+    objects[hash] = Object{QFileInfo(dst).size(), QDateTime()};
+  }
+  objects[hash].used = QDateTime::currentDateTime();
+  keys[key(url, etag)] = hash;
+
+  evict();
+  return saveIndex();
+}
+
+QString DownloadCache::key(const QUrl &url, const QByteArray &etag) {
+  return url.toString(QUrl::FullyEncoded) + " " + QString::fromUtf8(etag);
+}
+
+QString DownloadCache::objectPath(const QString &hash) const {
+  return QDir{dir}.absoluteFilePath("objects/" + hash);
+}
+
+bool DownloadCache::loadIndex() {
+  keys.clear();
+  objects.clear();
+
+  QFile file{QDir{dir}.absoluteFilePath("index.json")};
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  QJsonObject root{QJsonDocument::fromJson(file.readAll()).object()};
+  if (root["version"].toInt() != VERSION) {
+    qWarning() << "WARN Ignoring invalid cache index in" << qPrintable(dir);
+    return false;
+  }
+
+  QJsonObject list{root["objects"].toObject()};
+  for (auto it = list.constBegin(); it != list.constEnd(); ++it) {
+    QJsonObject obj{it.value().toObject()};
+    objects[it.key()] =
+      Object{(qint64) obj["size"].toDouble(),
+             QDateTime::fromMSecsSinceEpoch((qint64) obj["used"].toDouble())};
+  }
+
+  list = root["keys"].toObject();
+  for (auto it = list.constBegin(); it != list.constEnd(); ++it) {
+    keys[it.key()] = it.value().toString();
+  }
+  return true;
+}
+
+bool DownloadCache::saveIndex() {
+  QJsonObject objs;
+  for (auto it = objects.constBegin(); it != objects.constEnd(); ++it) {
+    QJsonObject obj;
+    obj["size"] = (double) it->size;
+    obj["used"] = (double) it->used.toMSecsSinceEpoch();
+    objs[it.key()] = obj;
+  }
+
+  QJsonObject list;
+  for (auto it = keys.constBegin(); it != keys.constEnd(); ++it) {
+    list[it.key()] = it.value();
+  }
+
+  QJsonObject root;
+  root["version"] = VERSION;
+  root["objects"] = objs;
+  root["keys"] = list;
+
+  QSaveFile file{QDir{dir}.absoluteFilePath("index.json")};
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  file.write(QJsonDocument{root}.toJson(QJsonDocument::Compact));
+  return file.commit();
+}
+
+void DownloadCache::evict() {
+  if (maxSize < 0) return;
+
+  qint64 total{0};
+  foreach (const auto &obj, objects) {
+    total += obj.size;
+  }
+
+  // Remove the least recently used objects and the keys pointing to
+  // them until it fits.
+  while (total > maxSize && !objects.isEmpty()) {
+    auto oldest = objects.begin();
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+      if (it->used < oldest->used) {
+        oldest = it;
+      }
+    }
+
+    QString hash{oldest.key()}, path{objectPath(hash)};
+    total -= oldest->size;
+    objects.erase(oldest);
+
+    // The object might be hard linked by a user, so its permissions are
+    // left alone where they do not prevent removing it.
+#ifdef WIN32
+    QFile::setPermissions(path, QFile::ReadOwner | QFile::WriteOwner);
+#endif
+    QFile::remove(path);
+
+    for (auto it = keys.begin(); it != keys.end();) {
+      if (it.value() == hash) {
+        it = keys.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+}
+
+END_NAMESPACE
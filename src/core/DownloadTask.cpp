@@ -5,13 +5,42 @@
 #include <QNetworkAccessManager>
 
 #include "Util.h"
+#include "BufferPool.h"
+#include "MemoryBudget.h"
 #include "DownloadTask.h"
 
+namespace {
+  // Reads directly into the buffer instead of allocating a new one, but
+  // never beyond max bytes.
+  void readAvailable(QNetworkReply *rep, QByteArray *data, qint64 max) {
+    qint64 avail{qMin(rep->bytesAvailable(), max - data->size())};
+    if (avail <= 0) return;
+    int size{data->size()};
+    data->resize(size + avail);
+    qint64 got{rep->read(data->data() + size, avail)};
+    data->resize(size + qMax(got, qint64(0)));
+  }
+
+  // Reads into the target and returns false if there is no room left.
+  bool readAvailable(QNetworkReply *rep, char *target, qint64 size,
+                     qint64 &received) {
+    qint64 avail{rep->bytesAvailable()};
+    if (avail <= 0) return true;
+    if (received + avail > size) return false;
+    qint64 got{rep->read(target + received, avail)};
+    received += qMax(got, qint64(0));
+    return true;
+  }
+}
+
 BEGIN_NAMESPACE
 
-DownloadTask::DownloadTask(const QUrl &url, Range range, int num,
+const qint64 DownloadTask::MAX_SEGMENT;
+
+DownloadTask::DownloadTask(const QUrl &url, Range range, qint64 num,
                            const QString &httpUser, const QString &httpPass)
-  : url{url}, range{range}, num{num}, httpUser{httpUser}, httpPass{httpPass}
+  : url{url}, range{range}, num{num}, httpUser{httpUser}, httpPass{httpPass},
+    bufferPool{nullptr}, memoryBudget{nullptr}, target{nullptr}
 { }
 
 void DownloadTask::onProgress(qint64 received, qint64 total) {
@@ -24,10 +53,14 @@ void DownloadTask::run() {
 
   // Only set range information if appropriate.
   qint64 start = range.first, end = range.second;
-  if (!(start == 0 && end == 0)) {
+  bool ranged = !(start == 0 && end == 0);
+  if (ranged) {
     QString rangeHdr = QString("bytes=%1-%2").arg(start).arg(end);
     //qDebug() << "RANGE" << qPrintable(rangeHdr);
     req.setRawHeader("Range", rangeHdr.toUtf8());
+    if (!ifRange.isEmpty()) {
+      req.setRawHeader("If-Range", ifRange);
+    }
   }
 
   if (!httpUser.isEmpty() && !httpPass.isEmpty()) {
@@ -35,6 +68,18 @@ void DownloadTask::run() {
                      Util::createHttpAuthHeader(httpUser, httpPass));
   }
 
+  // Wait for room in the memory budget before requesting the chunk so
+  // the connection stays paused instead of buffering data.
+  qint64 size{ranged ? end - start + 1 : 0}, held{0};
+  if (memoryBudget && size > 0 && !target) {
+    while (!memoryBudget->acquire(size, 500)) {
+      if (isInterruptionRequested()) {
+        return;
+      }
+    }
+    held = size;
+  }
+
   QNetworkAccessManager netmgr;
   auto *rep = netmgr.get(req);
   emit started(num);
@@ -42,6 +87,16 @@ void DownloadTask::run() {
   connect(rep, &QNetworkReply::downloadProgress,
           this, &DownloadTask::onProgress);
 
+  // Buffers never exceed MAX_SEGMENT so QByteArray can hold them no
+  // matter how large the range is.
+  QByteArray *data{nullptr};
+  qint64 received{0}, pos{0};
+  bool overflow{false};
+  if (!target) {
+    qint64 bufSize{qMin(size, MAX_SEGMENT)};
+    data = (bufferPool ? bufferPool->acquire(bufSize) : new QByteArray);
+  }
+
   QDateTime lastTime{QDateTime::currentDateTime()};
   for (;;) {
     // Only check for interrupt every half second.
@@ -49,6 +104,7 @@ void DownloadTask::run() {
     if (lastTime.msecsTo(now) > 500) {
       if (isInterruptionRequested()) {
         rep->abort();
+        releaseData(data, held);
         return;
       }
       lastTime = now;
@@ -58,32 +114,123 @@ void DownloadTask::run() {
       break;
     }
 
+    // A full response to a conditional range request means the remote
+    // file changed, so stop immediately instead of receiving all of it.
+    if (ranged && !ifRange.isEmpty()) {
+      auto attr = rep->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+      if (attr.isValid() && attr.toInt() == 200) {
+        rep->abort();
+        releaseData(data, held);
+        emit failed(num, range, 200, QNetworkReply::NoError);
+        return;
+      }
+    }
+
     QCoreApplication::processEvents();
+    if (target) {
+      overflow = !readAvailable(rep, target, size, received);
+      if (overflow) {
+        rep->abort();
+        break;
+      }
+      while (received - pos >= MAX_SEGMENT) {
+        emit segment(num, start + pos,
+                     new QByteArray(QByteArray::fromRawData(target + pos,
+                                                            MAX_SEGMENT)));
+        pos += MAX_SEGMENT;
+      }
+    }
+    else {
+      readSegments(rep, data, size, pos, held);
+    }
     msleep(10);
   }
+  if (target) {
+    overflow = overflow || !readAvailable(rep, target, size, received);
+  }
+  else {
+    readSegments(rep, data, size, pos, held);
+  }
 
   int code = rep->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
   //qDebug() << "CODE" << code;
   //qDebug() << "HEADERS" << rep->rawHeaderPairs();
 
   // Direct or partial download.
-  bool ok = false;
-  QByteArray *dataPtr{nullptr};
-  if (code == 200 || code == 206) {
-    ok = true;
-    dataPtr = new QByteArray;
-    *dataPtr = rep->readAll();
-  }
+  bool ok = (code == 206 || (code == 200 && (!ranged || ifRange.isEmpty())));
+  ok = ok && !overflow;
 
+  // A transfer that broke off, or ended early without an error, must not
+  // pass for the whole chunk.
   auto error = rep->error();
+  qint64 got{target ? received : pos + data->size()};
+  QVariant length{rep->header(QNetworkRequest::ContentLengthHeader)};
+  bool complete{ranged ? got == size
+                : !length.isValid() || got == length.toLongLong()};
+  ok = ok && error == QNetworkReply::NoError && complete;
   rep->close();
 
   if (ok) {
-    emit finished(num, range, dataPtr);
+    // The data is already in place so only pass on a view of it.
+    if (target) {
+      data = new QByteArray(QByteArray::fromRawData(target + pos,
+                                                    received - pos));
+    }
+    else {
+      handOff(data, held);
+      if (memoryBudget && held > 0) {
+        memoryBudget->release(held);
+      }
+    }
+    emit finished(num, range, start + pos, data);
   }
   else {
+    releaseData(data, held);
     emit failed(num, range, code, error);
   }
 }
 
+void DownloadTask::readSegments(QNetworkReply *rep, QByteArray *&data,
+                                qint64 size, qint64 &pos, qint64 &held) {
+  readAvailable(rep, data, MAX_SEGMENT);
+
+  // Pass on full buffers as segments while more data is waiting.
+  while (data->size() >= MAX_SEGMENT && rep->bytesAvailable() > 0) {
+    qint64 len{data->size()};
+    handOff(data, held);
+    emit segment(num, range.first + pos, data);
+    pos += len;
+
+    qint64 bufSize{qMax(qint64(0), qMin(size - pos, MAX_SEGMENT))};
+    data = (bufferPool ? bufferPool->acquire(bufSize) : new QByteArray);
+    readAvailable(rep, data, MAX_SEGMENT);
+  }
+}
+
+void DownloadTask::handOff(QByteArray *data, qint64 &held) {
+  // From now on the budget is accounted for by the size of the data
+  // until it has been committed.
+  if (!memoryBudget) return;
+  qint64 len{data->size()};
+  if (len > held) {
+    memoryBudget->reserve(len - held);
+    held = 0;
+  }
+  else {
+    held -= len;
+  }
+}
+
+void DownloadTask::releaseData(QByteArray *data, qint64 held) {
+  if (memoryBudget) {
+    memoryBudget->release(held);
+  }
+  if (bufferPool) {
+    bufferPool->release(data);
+  }
+  else {
+    delete data;
+  }
+}
+
 END_NAMESPACE
@@ -1,9 +1,13 @@
+#include <cstring>
 #include <sstream>
 #include <iostream>
 
 #include <QDir>
 #include <QDebug>
 #include <QFileInfo>
+#include <QSaveFile>
+#include <QJsonObject>
+#include <QJsonDocument>
 #include <QEventLoop>
 #include <QMutexLocker>
 #include <QNetworkReply>
@@ -14,19 +18,40 @@
 #include "Downloader.h"
 #include "DownloadTask.h"
 
+namespace {
+  // Amount of data requested together with the headers.
+  const qint64 PROBE_SIZE{1048576}; // 1 MB
+
+  const int MAX_REDIRECTS{20};
+
+  // Default amount of data held back for writing to ordered sinks.
+  const qint64 STREAM_WINDOW{67108864}; // 64 MB
+}
+
 BEGIN_NAMESPACE
 
 Downloader::Downloader(const QUrl &url)
-  : url{url}, conns{1}, chunks{-1}, chunkSize{-1}, downloadCount{0},
-    rangeCount{0}, contentLen{-1}, offset{0}, confirm{false}, resume{false},
+  : url{url}, origUrl{url}, conns{1}, hole{0}, chunks{-1}, chunkSize{-1},
+    downloadCount{0}, rangeCount{0}, nextNum{1}, contentLen{-1}, offset{0},
+    resumeCheck{0}, bytesReceived{0}, rangeSize{0}, cursor{0}, probeSize{0},
+    redirects{0}, confirm{false}, resume{false}, probing{false},
+    probed{false}, probeCut{false}, startRequested{false}, cached{false},
     verbose{false}, dryRun{false}, showHeaders{false}, single{true},
-    resumable{false}, reply{nullptr}
+    resumable{false}, prealloc{true}, useMap{false}, restarting{false},
+    restarted{false}, mapping{nullptr}, netmgr{&ownNetmgr},
+    reply{nullptr}, memoryBudget{nullptr}, metadataCache{nullptr},
+    validatorStore{nullptr}, hasLocalCopy{false}, downloadCache{nullptr},
+    dedupe{false}, sinkOpen{false}, streamWindow{STREAM_WINDOW}, streamed{0},
+    active{0}
 {
+  commitThread.setBufferPool(&bufferPool);
   connect(&commitThread, &CommitThread::finished,
           this, &Downloader::onCommitThreadFinished);
   connect(this, &Downloader::chunkToThread,
           &commitThread, &CommitThread::enqueueChunk,
           Qt::QueuedConnection);
+  connect(&commitThread, &CommitThread::streamed,
+          this, &Downloader::onStreamed);
 }
 
 void Downloader::setHttpCredentials(const QString &user,
@@ -35,69 +60,131 @@ void Downloader::setHttpCredentials(const QString &user,
   httpPass = pass;
 }
 
+void Downloader::setNetworkAccessManager(QNetworkAccessManager *mgr) {
+  netmgr = (mgr ? mgr : &ownNetmgr);
+}
+
+void Downloader::setMemoryBudget(MemoryBudget *budget) {
+  memoryBudget = budget;
+  commitThread.setMemoryBudget(budget);
+}
+
+void Downloader::probe() {
+  if (probing || probed) return;
+  probing = true;
+  redirects = 0;
+  probeLog.clear();
+  probeError.clear();
+  probeTimer.start();
+
+  // A current local copy makes the probe conditional.
+  hasLocalCopy = (validatorStore && !resume &&
+                  validatorStore->lookup(origUrl, localCopy) &&
+                  isOutputPath(localCopy.path));
+
+  cached = (metadataCache && !resume &&
+            metadataCache->lookup(origUrl, cachedInfo));
+  if (cached) {
+    finishProbe();
+    return;
+  }
+
+  // Fetch HEAD to find out the size but also if it exists. Unless only
+  // probing or resuming, the first chunk is requested at the same time
+  // to save a round trip.
+  probeSize = 0;
+  if (!dryRun && !resume) {
+    probeSize = (chunkSize != -1 ? qMin(chunkSize, PROBE_SIZE) : PROBE_SIZE);
+  }
+  sendProbe(url);
+}
+
 void Downloader::start() {
-  // Fetch HEAD to find out the size but also if it exists.
-  reply = getHead(url);
-  if (!reply) {
-    QCoreApplication::exit(-1);
+  // Probing might already have been started ahead of time.
+  startRequested = true;
+  if (!probed) {
+    probe();
     return;
   }
-  url = reply->url();
 
-  // Find "Content-Length". If not found then it keeps operating (with
-  // a single connection) not knowing the total size but it will
-  // eventually be known from the first chunk progress information.
-  bool ok;
-  if (reply->hasRawHeader("Content-Length")) {
-    contentLen =
-      QString::fromUtf8(reply->rawHeader("Content-Length")).toLongLong(&ok);
-    if (!ok || contentLen == 0) {
-      qCritical() << "ERROR Invalid content length:" << contentLen;
-      contentLen = -1;
-    }
+  // Everything the old version left queued arrived before the new probe.
+  if (restarting) {
+    restarting = false;
+    commitThread.setJournal(nullptr);
+    commitThread.reset();
   }
 
-  // Check if the total is different than the Content-Length and, if
-  // so, then change to that number.
-  if (reply->hasRawHeader("Content-Range")) {
-    single = false;
-    QString range = QString::fromUtf8(reply->rawHeader("Content-Range"));
-    QStringList elms = range.split("/", QString::SkipEmptyParts);
-    if (elms.size() == 2) {
-      qint64 tot = elms[1].toLongLong(&ok);
-      if (ok && tot > 0 && tot != contentLen) {
-        contentLen = tot;
-      }
-    }
+  // Messages are only printed now so probes running ahead of time do not
+  // interfere with the output of other downloads.
+  foreach (const auto &line, probeLog) {
+    qDebug() << qPrintable(line);
+  }
+  if (!reply && !cached) {
+    fail(probeError);
+    return;
   }
 
-  QString type;
-  if (reply->hasRawHeader("Content-Type")) {
-    type = QString::fromUtf8(reply->rawHeader("Content-Type"));
-    int pos;
-    if ((pos = type.indexOf(";")) != -1) {
-      type = type.mid(0, pos);
+  // Nothing to download if the server says the local copy is current.
+  if (!cached && hasLocalCopy &&
+      reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304) {
+    reply->close();
+    reply->deleteLater();
+    reply = nullptr;
+    finishUpToDate();
+    return;
+  }
+
+  // Use what is known about the remote file from the probe or the
+  // metadata cache.
+  ResourceInfo info;
+  if (cached) {
+    info = cachedInfo;
+  }
+  else {
+    info = readProbe();
+
+    // Clean reply.
+    reply->close();
+    reply->deleteLater();
+    reply = nullptr;
+
+    if (metadataCache) {
+      metadataCache->insert(origUrl, info);
     }
   }
+  if (verbose) {
+    qDebug() << "METADATA" << qPrintable(cached ? "cached" : "probed")
+             << "in" << probeTimer.elapsed() << "ms";
+  }
 
-  // Check if filename is defined.
-  if (reply->hasRawHeader("Content-Disposition")) {
-    QString hdr = QString::fromUtf8(reply->rawHeader("Content-Disposition"));
-    int pos = hdr.indexOf("; filename=");
-    if (pos != -1) {
-      hdr = hdr.mid(pos + 11).trimmed();
-      if (hdr.startsWith("\"")) {
-        hdr = hdr.mid(1);
-      }
-      if (hdr.endsWith("\"")) {
-        hdr.chop(1);
-      }
-      if (!hdr.isEmpty()) {
-        fileOverride = hdr;
-      }
+  // Servers that ignore conditional requests still tell whether the
+  // local copy matches.
+  if (isUpToDate(info)) {
+    finishUpToDate();
+    return;
+  }
+
+  if (info.url != url) {
+    qDebug() << "Resolved to"
+             << qPrintable(info.url.toString(QUrl::FullyEncoded));
+
+    if (confirm &&
+        !Util::askProceed(tr("Do you want to continue?") + " [y/N] ")) {
+      fail("Aborting..");
+      return;
     }
   }
 
+  url = info.url;
+  contentLen = info.size;
+  single = info.single;
+  resumable = info.resumable;
+  etag = info.etag;
+  lastModified = info.lastModified;
+  if (!info.filename.isEmpty()) {
+    fileOverride = info.filename;
+  }
+
   QString fsize;
   if (contentLen == -1) {
     fsize = "Unknown";
@@ -106,46 +193,90 @@ void Downloader::start() {
     fsize = Util::formatSize(contentLen, 1);
   }
   qDebug() << "File size" << qPrintable(fsize)
-           << qPrintable(!type.isEmpty() ? "[" + type + "]" : "");
+           << qPrintable(!info.type.isEmpty() ? "[" + info.type + "]" : "");
 
-  // Check for header "Accept-Ranges" and whether it has "bytes"
-  // supported.
-  resumable = false;
-  if (reply->hasRawHeader("Accept-Ranges")) {
-    const QString ranges = QString::fromUtf8(reply->rawHeader("Accept-Ranges"));
-    resumable = ranges.toLower().contains("bytes");
-  }
   if (verbose) {
     qDebug() << qPrintable(QString("%1RESUMABLE").
                            arg(resumable ? "" : "NOT "));
   }
 
   if (!resumable && resume) {
-    qCritical() << "ERROR Cannot resume because server doesn't support it!";
-    QCoreApplication::exit(-1);
+    fail("ERROR Cannot resume because server doesn't support it!");
     return;
   }
   else if (resumable && resume && contentLen == -1) {
-    qCritical() << "ERROR Cannot resume because the content length is unknown!";
-    QCoreApplication::exit(-1);
+    fail("ERROR Cannot resume because the content length is unknown!");
     return;
   }
 
-  // Clean reply.
-  reply->close();
-  reply = nullptr;
-
   // If performing a dry run then stop now.
   if (dryRun) {
     emit finished();
     return;
   }
 
-  if (!setupFile()) {
-    QCoreApplication::exit(-1);
+  // Take the file from the local cache if it has this version of it.
+  if (downloadCache) {
+    QString path{resolveOutputPath()};
+    if (downloadCache->fetch(origUrl, etag, path)) {
+      probeData.clear();
+      outputPath = path;
+      journal.setPath(ResumeJournal::pathFor(outputPath));
+      journal.remove();
+      recordValidators();
+      qDebug() << "Copied from cache to" << qPrintable(outputPath);
+      emit completedLocally(outputPath);
+      emit finished();
+      return;
+    }
+  }
+
+  // Another process might already be downloading the same URL.
+  if (dedupe && !acquireTransfer()) {
+    qDebug() << "Waiting for other process downloading to"
+             << qPrintable(ownerPath);
+    outputPath = resolveOutputPath();
+    emit information(outputPath, contentLen, 1, 0, 0);
+    emit chunkStarted(1);
+    connect(&ownerTimer, &QTimer::timeout, this, &Downloader::onOwnerPoll);
+    ownerTimer.start(500);
+    return;
+  }
+
+  begin();
+}
+
+void Downloader::begin() {
+  // Files that fit in the probe are already downloaded.
+  if (!resume && !sink && !probeData.isEmpty() &&
+      probeData.size() == contentLen) {
+    writeWhole();
     return;
   }
 
+  if (!(sink ? setupSink() : setupFile())) {
+    fail();
+    return;
+  }
+
+  // Cached metadata might be stale so let the server confirm it.
+  if (cached && resumable && ifRange.isEmpty()) {
+    ifRange = getValidator();
+  }
+
+  // Only use the probe data if the start of the file is still missing.
+  if (!probeData.isEmpty() && !missing.isEmpty() && missing.first().first == 0) {
+    Range &first = missing.first();
+    probeData.truncate(qMin<qint64>(probeData.size(), first.second));
+    first.first = probeData.size();
+    if (first.first == first.second) {
+      missing.removeFirst();
+    }
+  }
+  else {
+    probeData.clear();
+  }
+
   createRanges();
   setupThreadPool();
 
@@ -156,43 +287,380 @@ void Downloader::start() {
 }
 
 void Downloader::stop() {
+  // Exhaust the ranges so tasks finishing meanwhile start no new ones.
+  nextNum = rangeCount + 1;
   pool.stop();
+  ownerTimer.stop();
+
+  // Ignore a probe still in flight.
+  if (reply) {
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+    reply = nullptr;
+  }
 
   if (commitThread.isRunning()) {
     commitThread.requestInterruption();
     commitThread.wait();
   }
+  if (sinkOpen) {
+    sinkOpen = false;
+    sink->abort();
+  }
+  transferLock.reset();
 }
 
-void Downloader::onDownloadTaskFinished(int num, Range range, QByteArray *data) {
+void Downloader::onOwnerPoll() {
+  bool done{false};
+  if (!transferLock->tryLock(0)) {
+    QString current{readOwner(done)};
+    if (!current.isEmpty()) {
+      ownerPath = current;
+    }
+
+    // Show progress from the journal of the owner.
+    ResumeJournal owner;
+    owner.setPath(ResumeJournal::pathFor(ownerPath));
+    if (owner.load()) {
+      emit chunkProgress(1, owner.getBytesDone(), contentLen);
+    }
+    return;
+  }
+  ownerTimer.stop();
+
+  // The owner might have finished between the last poll and releasing
+  // the lock, which it does only after writing the owner file.
+  QString current{readOwner(done)};
+  if (!current.isEmpty()) {
+    ownerPath = current;
+  }
+
+  // The owner finished so the file can be copied.
+  QString path{resolveOutputPath()};
+  if (done && (contentLen == -1 ||
+               QFileInfo(ownerPath).size() == contentLen)) {
+    transferLock.reset();
+    if (ownerPath != path && !Util::cloneFile(ownerPath, path)) {
+      fail(QString("ERROR Could not copy %1 to %2").arg(ownerPath).arg(path));
+      return;
+    }
+    outputPath = path;
+    recordValidators();
+    qDebug() << "Downloaded by other process to" << qPrintable(ownerPath);
+    emit completedLocally(outputPath);
+    emit finished();
+    return;
+  }
+
+  // The owner went away without finishing so take over. Its progress can
+  // be resumed if it was writing to the same file.
+  qDebug() << "Taking over download from other process";
+  if (ownerPath == path && resumable &&
+      QFile::exists(ResumeJournal::pathFor(path))) {
+    resume = true;
+  }
+  writeOwner(false);
+  begin();
+}
+
+bool Downloader::acquireTransfer() {
+  QString base{QDir::temp().absoluteFilePath("efdl-" +
+    QString::fromUtf8(QCryptographicHash::hash(origUrl.toEncoded(),
+                                               QCryptographicHash::Sha1).toHex()))};
+  ownerFile = base + ".owner";
+  transferLock.reset(new QLockFile{base + ".lock"});
+
+  // The owner might download for a long time so only consider the lock
+  // stale when its process is gone.
+  transferLock->setStaleLockTime(0);
+  if (transferLock->tryLock(0)) {
+    writeOwner(false);
+    return true;
+  }
+
+  bool done;
+  ownerPath = readOwner(done);
+  return false;
+}
+
+void Downloader::writeOwner(bool done) {
+  QJsonObject obj;
+  obj["path"] = resolveOutputPath();
+  obj["done"] = done;
+  QSaveFile file{ownerFile};
+  if (file.open(QIODevice::WriteOnly)) {
+    file.write(QJsonDocument{obj}.toJson(QJsonDocument::Compact));
+    file.commit();
+  }
+}
+
+QString Downloader::readOwner(bool &done) const {
+  done = false;
+  QFile file{ownerFile};
+  if (!file.open(QIODevice::ReadOnly)) {
+    return QString();
+  }
+  QJsonObject obj{QJsonDocument::fromJson(file.readAll()).object()};
+  done = obj["done"].toBool();
+  return obj["path"].toString();
+}
+
+void Downloader::onDownloadTaskSegment(qint64 num, qint64 pos,
+                                       QByteArray *data) {
+  Q_UNUSED(num);
+  if (restarting) {
+    commitThread.enqueueChunk(pos, data); // released by the reset
+    return;
+  }
+
+  QMutexLocker locker{&finishedMutex};
+  bytesReceived += data->size();
+  emit chunkToThread(pos, data, false);
+  if (!commitThread.isRunning() && !commitThread.hasError()) {
+    commitThread.start();
+  }
+}
+
+void Downloader::onDownloadTaskFinished(qint64 num, Range range, qint64 pos,
+                                        QByteArray *data) {
+  if (restarting) {
+    commitThread.enqueueChunk(pos, data); // released by the reset
+    return;
+  }
+
+  commitChunk(num, range, pos, data);
+
+  // Take the freed connection with the next range.
+  active--;
+  startTasks();
+}
+
+void Downloader::onStreamed(qint64 pos) {
+  // Connections held back by the window can continue.
+  streamed = pos;
+  startTasks();
+}
+
+void Downloader::commitChunk(qint64 num, Range range, qint64 pos,
+                             QByteArray *data) {
   QMutexLocker locker{&finishedMutex};
-  chunksMap[range.first] = data;
   downloadCount++;
-  saveChunk();
+  bytesReceived += data->size();
+
+  // Chunks are written at their own position so they can be
+  // committed right away regardless of order.
+  emit chunkToThread(pos, data, rangeCount == downloadCount);
+  if (!commitThread.isRunning() && !commitThread.hasError()) {
+    commitThread.start();
+  }
 
   emit chunkFinished(num, range);
 }
 
-void Downloader::onDownloadTaskFailed(int num, Range range, int httpCode,
+void Downloader::onDownloadTaskFailed(qint64 num, Range range, int httpCode,
                                       QNetworkReply::NetworkError error) {
+  if (restarting) return;
+
+  // The server ignored If-Range so the remote file changed since the
+  // local data was written. Drop the journal so the next attempt starts
+  // over instead of mixing two versions of the file.
+  if (httpCode == 200 && !ifRange.isEmpty()) {
+    // Nothing was resumed, only the cached metadata was stale, so the
+    // download can start over. A sink might already have passed data on.
+    if (cached && !sink && !restarted) {
+      restart();
+      return;
+    }
+
+    qCritical() << "ERROR Remote file changed since download was started!";
+    stop();
+    journal.remove();
+    if (metadataCache) {
+      metadataCache->remove(origUrl);
+    }
+  }
+
   emit chunkFailed(num, range, httpCode, error);
 }
 
+void Downloader::restart() {
+  qWarning() << "WARN Remote file changed since it was cached, starting over";
+
+  // Tasks and the commit thread are stopped, but what they emitted is
+  // still queued and belongs to the old version. It is dropped until the
+  // new probe comes back.
+  restarting = restarted = true;
+  stop();
+  journal.remove();
+  metadataCache->remove(origUrl);
+
+  url = origUrl;
+  cached = probed = false;
+  ifRange.clear();
+  probeData.clear();
+  downloadCount = bytesReceived = offset = 0;
+  probe();
+}
+
 void Downloader::onCommitThreadFinished() {
+  // Stopped to start over.
+  if (restarting) return;
+
+  if (verbose) {
+    qint64 bytes{commitThread.getBytesWritten()}, msecs{commitThread.getElapsed()};
+    double gbs{(double) bytes / 1073741824.0};
+    qDebug() << "COMMITTED" << qPrintable(Util::formatSize(bytes, 1))
+             << "using" << qPrintable(commitThread.getBackendName())
+             << "in" << commitThread.getSyscalls() << "syscalls"
+             << qPrintable(QString("(%1 per GB, %2/s)")
+                           .arg(gbs > 0 ? commitThread.getSyscalls() / gbs : 0, 0, 'f', 0)
+                           .arg(Util::formatSize(msecs > 0 ? bytes * 1000 / msecs : 0, 1)));
+    if (commitThread.getSyncs() > 0) {
+      qDebug() << "SYNCED" << commitThread.getSyncs() << "times";
+    }
+
+    // Bytes are copied once out of the reply and once more when written
+    // to the page cache, unless received directly into a mapping.
+    if (bytesReceived > 0) {
+      double copies{(double) (bytesReceived + bytes) / bytesReceived};
+      qDebug() << "COPIES" << qPrintable(QString::number(copies, 'f', 2))
+               << "per byte received" << qPrintable(mapping ? "(mapped)" : "");
+    }
+
+    quint64 hits{bufferPool.getHits()}, total{hits + bufferPool.getMisses()};
+    qDebug() << "BUFFERS" << hits << "of" << total << "reused"
+             << qPrintable(QString("(%1%), peak %2")
+                           .arg(total > 0 ? (double) hits / total * 100.0 : 0, 0, 'f', 1)
+                           .arg(Util::formatSize(bufferPool.getPeakBytes(), 1)));
+  }
+
+  // Data that could not be written must not count as downloaded. The
+  // journal only has what was written so the download can be resumed.
+  if (commitThread.hasError()) {
+    if (sinkOpen) {
+      sinkOpen = false;
+      sink->abort();
+    }
+    fail("ERROR Could not write output: " + commitThread.getError());
+    return;
+  }
+
+  // The file is preallocated and chunks might have been cut short, so
+  // only the journal, if kept, or the bytes received tell whether all
+  // data is there.
+  bool complete{contentLen != -1 && downloadCount == rangeCount &&
+                (journal.getContentLength() != -1 ? journal.isComplete()
+                 : offset + bytesReceived == contentLen)};
+
+  // The journal is not needed anymore when everything was committed.
+  if (journal.isComplete() && !journal.remove()) {
+    qWarning() << "WARN Could not remove resume journal:"
+               << qPrintable(journal.getPath());
+  }
+
+  if (sinkOpen) {
+    sinkOpen = false;
+    if (sink->hasError()) {
+      sink->abort();
+      fail("ERROR Could not write output: " + sink->getError());
+      return;
+    }
+    if (downloadCount != rangeCount) {
+      sink->abort();
+      fail("ERROR Download incomplete");
+      return;
+    }
+    if (!sink->finalize()) {
+      fail("ERROR Could not finalize output: " + sink->getError());
+      return;
+    }
+    finishDownload(false);
+    return;
+  }
+
+  finishDownload(complete);
+}
+
+void Downloader::finishDownload(bool complete) {
+  // Let processes waiting for this download know that it is done.
+  if (transferLock) {
+    writeOwner(complete);
+    transferLock.reset();
+  }
+
+  if (complete) {
+    recordValidators();
+    if (downloadCache && !downloadCache->store(origUrl, etag, outputPath) &&
+        verbose) {
+      qDebug() << "NOT CACHED";
+    }
+  }
+
   emit finished();
 }
 
-QNetworkReply *Downloader::getHead(const QUrl &url) {
+void Downloader::writeWhole() {
+  outputPath = resolveOutputPath();
+  qDebug() << "Saving to" << qPrintable(outputPath);
+
+  // There is nothing to resume when the file is written at once.
+  journal.setPath(ResumeJournal::pathFor(outputPath));
+  journal.remove();
+
+  // Unbuffered so the data is written with a single call.
+  QFile file{outputPath};
+  if ((file.exists() && !file.remove()) ||
+      !file.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+    fail("ERROR Could not open output file for writing!");
+    return;
+  }
+  if (file.write(probeData) != probeData.size()) {
+    fail("ERROR Could not write output file!");
+    return;
+  }
+  file.close();
+
+  // Hash while the data is still in memory instead of reading the file
+  // again afterwards.
+  foreach (auto alg, hashes.keys()) {
+    hashes[alg] = QCryptographicHash::hash(probeData, alg).toHex();
+  }
+
+  if (verbose) {
+    qDebug() << "COMMITTED" << qPrintable(Util::formatSize(contentLen, 1))
+             << "from probe in 1 syscall";
+  }
+
+  emit information(outputPath, contentLen, 1, 1, 0);
+  emit chunkStarted(1);
+  emit chunkProgress(1, contentLen, contentLen);
+  emit chunkFinished(1, Range{0, contentLen - 1});
+
+  probeData.clear();
+  finishDownload(true);
+}
+
+void Downloader::setHashes(const QList<QCryptographicHash::Algorithm> &algs) {
+  hashes.clear();
+  foreach (auto alg, algs) {
+    hashes[alg] = QByteArray();
+  }
+}
+
+void Downloader::sendProbe(const QUrl &url) {
   if (verbose) {
-    qDebug() << "HEAD" << qPrintable(url.toString(QUrl::FullyEncoded));
+    probeLog << "HEAD " + url.toString(QUrl::FullyEncoded);
   }
 
   // Emulating a HEAD by doing a GET which only retrieves range
-  // 0-0. This is necessary because some sites return different
-  // headers for HEAD/GET even though they should be the same!
+  // 0-0, or the first probeSize bytes. This is necessary because some
+  // sites return different headers for HEAD/GET even though they
+  // should be the same!
 
   QNetworkRequest req{url};
-  req.setRawHeader("Range", QString("bytes=0-0").toUtf8());
+  req.setRawHeader("Range", QString("bytes=0-%1")
+                   .arg(qMax(probeSize - 1, qint64(0))).toUtf8());
   req.setRawHeader("Accept-Encoding", "identity");
 
   if (!httpUser.isEmpty() && !httpPass.isEmpty()) {
@@ -200,100 +668,302 @@ QNetworkReply *Downloader::getHead(const QUrl &url) {
                      Util::createHttpAuthHeader(httpUser, httpPass));
   }
 
-  //auto *rep = netmgr.head(req);
-  auto *rep = netmgr.get(req);
+  if (hasLocalCopy) {
+    if (!localCopy.etag.isEmpty()) {
+      req.setRawHeader("If-None-Match", localCopy.etag);
+    }
+    else if (!localCopy.lastModified.isEmpty()) {
+      req.setRawHeader("If-Modified-Since", localCopy.lastModified);
+    }
+  }
 
-  QEventLoop loop;
-  connect(rep, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-  loop.exec();
+  //reply = netmgr->head(req);
+  reply = netmgr->get(req);
+  connect(reply, &QNetworkReply::finished, this, &Downloader::onProbeFinished);
+
+  // A server ignoring the range sends the whole file, which must not end
+  // up in memory. The headers are all the probe needs then.
+  probeCut = false;
+  auto *rep = reply;
+  auto cut = [this, rep] {
+    int code = rep->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    qint64 limit{qMax(probeSize, qint64(1))};
+    QVariant length{rep->header(QNetworkRequest::ContentLengthHeader)};
+    if (!probeCut && code == 200 &&
+        (length.toLongLong() > limit || rep->bytesAvailable() > limit)) {
+      probeCut = true;
+      rep->abort();
+    }
+  };
+  connect(reply, &QNetworkReply::metaDataChanged, this, cut);
+  connect(reply, &QNetworkReply::downloadProgress, this, cut);
+}
 
-  if (rep->error() != QNetworkReply::NoError) {
+void Downloader::onProbeFinished() {
+  auto *rep = reply;
+  reply = nullptr;
+
+  if (rep->error() != QNetworkReply::NoError &&
+      !(probeCut && rep->error() == QNetworkReply::OperationCanceledError)) {
     rep->abort();
-    qCritical() << "ERROR" << qPrintable(Util::getErrorString(rep->error()));
-    return nullptr;
+    rep->deleteLater();
+    finishProbe("ERROR " + Util::getErrorString(rep->error()));
+    return;
   }
 
   int code = rep->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
   if (verbose) {
-    qDebug() << "CODE" << code;
+    probeLog << QString("CODE %1").arg(code);
     if (showHeaders) {
-      qDebug() << "HEADERS"
-               << qPrintable(Util::formatHeaders(rep->rawHeaderPairs()));
+      probeLog << "HEADERS " + Util::formatHeaders(rep->rawHeaderPairs());
     }
   }
 
-  static bool didRedir = false;
-
-  if (code >= 200 && code < 300) {
-    if (url != this->url) {
-      qDebug() << "Resolved to"
-               << qPrintable(url.toString(QUrl::FullyEncoded));
-    }
-
-    if (confirm && didRedir) {
-      if (!Util::askProceed(tr("Do you want to continue?") + " [y/N] ")) {
-        rep->abort();
-        qCritical() << "Aborting..";
-        return nullptr;
-      }
-    }
+  if ((code >= 200 && code < 300) || (code == 304 && hasLocalCopy)) {
+    reply = rep;
+    finishProbe();
   }
 
   // Handle redirect.
   else if (code >= 300 && code < 400) {
     if (!rep->hasRawHeader("Location")) {
       rep->abort();
-      qCritical() << "ERROR Could not resolve URL!";
-      return nullptr;
+      rep->deleteLater();
+      finishProbe("ERROR Could not resolve URL!");
+      return;
     }
 
     QString locHdr = QString::fromUtf8(rep->rawHeader("Location"));
     QUrl loc{locHdr};
     if (!loc.isValid()) {
       rep->abort();
-      qCritical() << "ERROR Invalid redirection header:"
-                  << qPrintable(loc.toString(QUrl::FullyEncoded));
-      return nullptr;
+      rep->deleteLater();
+      finishProbe("ERROR Invalid redirection header: " +
+                  loc.toString(QUrl::FullyEncoded));
+      return;
     }
 
     // If relative then try resolving with the previous URL.
     if (loc.isRelative()) {
-      loc = url.resolved(loc);
+      loc = rep->url().resolved(loc);
     }
+    rep->abort();
+    rep->deleteLater();
 
-    if (verbose) {
-      qDebug() << "REDIRECT" << qPrintable(loc.toString(QUrl::FullyEncoded));
+    if (++redirects > MAX_REDIRECTS) {
+      finishProbe("ERROR Too many redirections!");
+      return;
     }
 
-    didRedir = true;
-    rep->abort();
-    rep = getHead(loc);
+    if (verbose) {
+      probeLog << "REDIRECT " + loc.toString(QUrl::FullyEncoded);
+    }
+    sendProbe(loc);
   }
 
   // Client errors.
   else if (code >= 400 && code < 500) {
     rep->abort();
-    qDebug() << "CLIENT ERROR";
-    return nullptr;
+    rep->deleteLater();
+    finishProbe("CLIENT ERROR");
   }
 
   // Server errors.
   else if (code >= 500 && code < 600) {
     rep->abort();
-    qDebug() << "SERVER ERROR";
-    return nullptr;
+    rep->deleteLater();
+    finishProbe("SERVER ERROR");
   }
 
-  return rep;
+  else {
+    reply = rep;
+    finishProbe();
+  }
 }
 
-bool Downloader::setupFile() {
+void Downloader::fail(const QString &error) {
+  if (!error.isEmpty()) {
+    qCritical() << qPrintable(error);
+  }
+  emit failed(error);
+}
+
+void Downloader::finishProbe(const QString &error) {
+  probing = false;
+  probed = true;
+  probeError = error;
+  emit probeFinished();
+  if (startRequested) {
+    start();
+  }
+}
+
+ResourceInfo Downloader::readProbe() {
+  ResourceInfo info;
+  info.url = reply->url();
+  info.fetched = QDateTime::currentDateTime();
+
+  // Find "Content-Length". If not found then it keeps operating (with
+  // a single connection) not knowing the total size but it will
+  // eventually be known from the first chunk progress information.
+  bool ok;
+  if (reply->hasRawHeader("Content-Length")) {
+    info.size =
+      QString::fromUtf8(reply->rawHeader("Content-Length")).toLongLong(&ok);
+    if (!ok || info.size == 0) {
+      qCritical() << "ERROR Invalid content length:" << info.size;
+      info.size = -1;
+    }
+  }
+
+  // Check if the total is different than the Content-Length and, if
+  // so, then change to that number.
+  if (reply->hasRawHeader("Content-Range")) {
+    info.single = false;
+    QString range = QString::fromUtf8(reply->rawHeader("Content-Range"));
+    QStringList elms = range.split("/", QString::SkipEmptyParts);
+    if (elms.size() == 2) {
+      qint64 tot = elms[1].toLongLong(&ok);
+      if (ok && tot > 0 && tot != info.size) {
+        info.size = tot;
+      }
+    }
+  }
+
+  if (reply->hasRawHeader("Content-Type")) {
+    info.type = QString::fromUtf8(reply->rawHeader("Content-Type"));
+    int pos;
+    if ((pos = info.type.indexOf(";")) != -1) {
+      info.type = info.type.mid(0, pos);
+    }
+  }
+
+  // Check if filename is defined.
+  if (reply->hasRawHeader("Content-Disposition")) {
+    QString hdr = QString::fromUtf8(reply->rawHeader("Content-Disposition"));
+    int pos = hdr.indexOf("; filename=");
+    if (pos != -1) {
+      hdr = hdr.mid(pos + 11).trimmed();
+      if (hdr.startsWith("\"")) {
+        hdr = hdr.mid(1);
+      }
+      if (hdr.endsWith("\"")) {
+        hdr.chop(1);
+      }
+      info.filename = hdr;
+    }
+  }
+
+  // Keep the body of the probe as the first chunk. A complete response
+  // also tells the size if it was not sent.
+  probeData.clear();
+  if (probeSize > 0 && !probeCut) {
+    probeData = reply->readAll();
+    int code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (code == 200 && info.size == -1 && !probeData.isEmpty()) {
+      info.size = probeData.size();
+    }
+
+    // A full response that is cut short cannot be continued with ranges.
+    if (info.size == -1 || probeData.size() > info.size ||
+        (code == 200 && probeData.size() != info.size)) {
+      probeData.clear();
+    }
+  }
+
+  // The validators are recorded in the resume journal so it can be
+  // detected if the remote file changes between runs.
+  info.etag = reply->rawHeader("ETag");
+  info.lastModified = reply->rawHeader("Last-Modified");
+
+  // Check for header "Accept-Ranges" and whether it has "bytes"
+  // supported.
+  if (reply->hasRawHeader("Accept-Ranges")) {
+    const QString ranges = QString::fromUtf8(reply->rawHeader("Accept-Ranges"));
+    info.resumable = ranges.toLower().contains("bytes");
+  }
+
+  // Partial content proves support even without "Accept-Ranges".
+  if (!info.single) {
+    info.resumable = true;
+  }
+  return info;
+}
+
+bool Downloader::isUpToDate(const ResourceInfo &info) const {
+  if (!hasLocalCopy || info.size != localCopy.size) {
+    return false;
+  }
+  if (!info.etag.isEmpty() || !localCopy.etag.isEmpty()) {
+    return info.etag == localCopy.etag && !info.etag.startsWith("W/");
+  }
+  return !info.lastModified.isEmpty() &&
+    info.lastModified == localCopy.lastModified;
+}
+
+void Downloader::finishUpToDate() {
+  probeData.clear();
+  outputPath = localCopy.path;
+  qDebug() << "Up to date" << qPrintable(outputPath);
+  emit completedLocally(outputPath);
+  emit finished();
+}
+
+QByteArray Downloader::getValidator() const {
+  // Weak entity tags cannot be used with If-Range.
+  return (!etag.isEmpty() && !etag.startsWith("W/") ? etag : lastModified);
+}
+
+void Downloader::recordValidators() {
+  // Remember the validators so the next run can skip the download if
+  // nothing changed.
+  if (!validatorStore || (etag.isEmpty() && lastModified.isEmpty())) {
+    return;
+  }
+  ValidatorStore::Entry entry;
+  entry.path = outputPath;
+  entry.size = contentLen;
+  entry.etag = etag;
+  entry.lastModified = lastModified;
+  entry.recorded = QDateTime::currentDateTime();
+  validatorStore->insert(origUrl, entry);
+}
+
+QString Downloader::resolveOutputPath() const {
+  if (!outputFile.isEmpty()) {
+    return QFileInfo(outputFile).absoluteFilePath();
+  }
+
   QFileInfo fi{url.path()};
   QDir dir = (outputDir.isEmpty() ? QDir::current() : outputDir);
   QString name = (fileOverride.isEmpty() ? fi.fileName() : fileOverride);
-  outputPath = dir.absoluteFilePath(name);
+  return dir.absoluteFilePath(name);
+}
+
+bool Downloader::isOutputPath(const QString &path) const {
+  QFileInfo fi{path};
+  if (fi.absoluteFilePath() == resolveOutputPath()) {
+    return true;
+  }
+
+  // Without an output file the name might come from the server, after
+  // redirections or from Content-Disposition, so only the directory is
+  // known before probing.
+  if (!outputFile.isEmpty() || !fileOverride.isEmpty()) {
+    return false;
+  }
+  QDir dir = (outputDir.isEmpty() ? QDir::current() : outputDir);
+  return fi.absoluteDir() == dir;
+}
+
+bool Downloader::setupFile() {
+  outputPath = resolveOutputPath();
   qDebug() << "Saving to" << qPrintable(outputPath);
 
+  // Only keep a journal when it is possible to resume later on.
+  bool useJournal{resumable && contentLen != -1};
+  journal.setPath(ResumeJournal::pathFor(outputPath));
+
   auto *file = new QFile{outputPath};
   if (file->exists() && !resume) {
     if (!QFile::remove(outputPath)) {
@@ -303,12 +973,60 @@ bool Downloader::setupFile() {
     }
   }
 
+  missing.clear();
+  ifRange.clear();
+  bool journaled{false};
   if (resume) {
-    qint64 fileSize{file->size()};
-    if (fileSize >= contentLen) {
-      qCritical() << "Cannot resume download because the size is larger than or"
-                  << "equal:" << qPrintable(Util::formatSize(fileSize, 1))
-                  << "vs." << qPrintable(Util::formatSize(contentLen, 1));
+    bool truncate{false};
+    Range committed{0, 0};
+
+    // Only the journal knows which ranges were committed. Chunks are
+    // written out of order into a preallocated or sparse file, so its
+    // size says nothing about what is there.
+    if (journal.load()) {
+      if (journal.getContentLength() != contentLen ||
+          journal.getETag() != etag ||
+          journal.getLastModified() != lastModified) {
+        qCritical() << "Cannot resume download because the remote file has"
+                    << "changed";
+        truncate = true;
+      }
+      else if (journal.isComplete()) {
+        qCritical() << "Cannot resume download because it is already complete";
+        truncate = true;
+      }
+      else {
+        missing = journal.getMissing();
+        offset = journal.getBytesDone();
+        journaled = true;
+        if (!journal.getRanges().isEmpty()) {
+          committed = journal.getRanges().last();
+        }
+      }
+    }
+    else if (file->exists()) {
+      qCritical() << "Cannot resume download because there is no valid resume"
+                  << "journal:" << qPrintable(journal.getPath());
+      truncate = true;
+    }
+
+    // Compare the tail of the local data with the remote file before
+    // trusting it. If that is not possible the local data is kept for a
+    // later attempt.
+    bool match{true};
+    if (!truncate && resumeCheck > 0) {
+      if (!checkTail(committed, match)) {
+        delete file;
+        return false;
+      }
+      if (!match) {
+        qCritical() << "Cannot resume download because the local data does not"
+                    << "match the remote file";
+        truncate = true;
+      }
+    }
+
+    if (truncate) {
       if (confirm &&
           !Util::askProceed("Do you want to truncate file and continue? [y/N] ")) {
         qCritical() << "Aborting..";
@@ -318,23 +1036,43 @@ bool Downloader::setupFile() {
       if (!confirm) {
         qDebug() << "Truncating file";
       }
-      resume = false;
+      resume = journaled = false;
+      offset = 0;
+      missing.clear();
     }
-    else if (fileSize > 0) {
-      offset = fileSize;
+    else if (offset > 0) {
       float perc = (long double)offset / (long double)contentLen * 100.0;
       qDebug() << "Resuming at offset"
                << qPrintable(Util::formatSize(offset, 1))
                << qPrintable(QString("(%1%)").arg(perc, 0, 'f', 1));
+
+      ifRange = getValidator();
+    }
+  }
+
+  if (!journaled) {
+    journal.clear();
+    journal.remove();
+    if (useJournal) {
+      journal.setContentLength(contentLen);
+      journal.setETag(etag);
+      journal.setLastModified(lastModified);
+      journal.addRange(Range{0, offset});
     }
   }
+  if (missing.isEmpty() && contentLen != -1) {
+    missing << Range{offset, contentLen};
+  }
 
-  QIODevice::OpenMode openMode{QIODevice::WriteOnly};
+  // Resuming writes at arbitrary positions so the file must be
+  // opened neither for truncation nor appending.
+  // A writable shared mapping also requires read access.
+  QIODevice::OpenMode openMode{QIODevice::WriteOnly | QIODevice::Truncate};
   if (resume) {
-    openMode |= QIODevice::Append;
+    openMode = QIODevice::ReadWrite;
   }
-  else {
-    openMode |= QIODevice::Truncate;
+  else if (useMap) {
+    openMode = QIODevice::ReadWrite | QIODevice::Truncate;
   }
 
   if (!file->open(openMode)) {
@@ -342,14 +1080,164 @@ bool Downloader::setupFile() {
     delete file;
     return false;
   }
+
+  // Reserve the space up front to fail early on a full disk and to keep
+  // the file contiguous. Chunks are written at their own position so
+  // the file size no longer tells how much was downloaded, which is
+  // what the journal is for.
+  if (prealloc && contentLen != -1) {
+    if (!Util::preallocateFile(*file, contentLen)) {
+      delete file;
+      return false;
+    }
+    if (verbose) {
+      qDebug() << "PREALLOCATED" << qPrintable(Util::formatSize(contentLen, 1));
+    }
+  }
+  // Map the entire file so connections receive straight into it and
+  // nothing has to be written afterwards.
+  mapping = nullptr;
+  if (useMap) {
+    if (contentLen == -1) {
+      qWarning() << "WARN Cannot map output file when the size is unknown!";
+    }
+    else if (file->size() < contentLen && !file->resize(contentLen)) {
+      qWarning() << "WARN Could not resize output file for mapping:"
+                 << qPrintable(file->errorString());
+    }
+    else {
+      mapping = reinterpret_cast<char*>(file->map(0, contentLen));
+      if (!mapping) {
+        qWarning() << "WARN Could not map output file:"
+                   << qPrintable(file->errorString());
+      }
+    }
+    if (!mapping) {
+      qWarning() << "WARN Falling back to writing chunks!";
+    }
+  }
+
   commitThread.setFile(file);
+  commitThread.setJournal(useJournal ? &journal : nullptr);
+  commitThread.setMapped(mapping != nullptr);
+
+  return true;
+}
+
+bool Downloader::setupSink() {
+  outputPath = sink->getName();
+  qDebug() << "Writing to" << qPrintable(outputPath);
+
+  if (!sink->open(contentLen)) {
+    qCritical() << "ERROR Could not open output:"
+                << qPrintable(sink->getError());
+    return false;
+  }
+  sinkOpen = true;
+
+  // Nothing can be resumed from a sink.
+  missing.clear();
+  ifRange.clear();
+  journal.clear();
+  if (contentLen != -1) {
+    missing << Range{0, contentLen};
+  }
+  streamed = 0;
+
+  // Receive directly into the memory of the sink if it has any.
+  mapping = (contentLen != -1 ? sink->getTarget() : nullptr);
+
+  // The window bounds the memory of ordered sinks instead of the budget.
+  // Waiting for the budget could starve the chunk that everything held
+  // back is waiting for.
+  bool ordered{!sink->isPositional()};
+  if (ordered) {
+    setMemoryBudget(nullptr);
+  }
 
+  commitThread.setSink(sink.data());
+  commitThread.setJournal(nullptr);
+  commitThread.setMapped(mapping != nullptr);
+  commitThread.setOrdered(ordered);
+  return true;
+}
+
+bool Downloader::checkTail(const Range &committed, bool &match) {
+  match = true;
+  qint64 start{qMax(committed.first, committed.second - resumeCheck)},
+    end{committed.second};
+  if (end <= start) {
+    return true;
+  }
+
+  QFile file{outputPath};
+  if (!file.open(QIODevice::ReadOnly) || !file.seek(start)) {
+    qCritical() << "ERROR Could not read local data to compare:"
+                << qPrintable(file.errorString());
+    return false;
+  }
+
+  // Local data missing where the journal says it was committed does not
+  // match either.
+  QByteArray local{file.read(end - start)};
+  if (local.size() != end - start) {
+    match = false;
+    return true;
+  }
+
+  QNetworkRequest req{url};
+  req.setRawHeader("Range",
+                   QString("bytes=%1-%2").arg(start).arg(end - 1).toUtf8());
+  req.setRawHeader("Accept-Encoding", "identity");
+
+  if (!httpUser.isEmpty() && !httpPass.isEmpty()) {
+    req.setRawHeader("Authorization",
+                     Util::createHttpAuthHeader(httpUser, httpPass));
+  }
+
+  auto *rep = netmgr->get(req);
+
+  QEventLoop loop;
+  connect(rep, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+  loop.exec();
+
+  // Only the requested range can be compared. Anything else, like a
+  // network error, says nothing about the local data.
+  QByteArray remote;
+  int code = rep->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  QByteArray expected{QString("bytes %1-%2/").arg(start).arg(end - 1).toUtf8()};
+  bool ok{rep->error() == QNetworkReply::NoError && code == 206 &&
+      rep->rawHeader("Content-Range").startsWith(expected)};
+  if (ok) {
+    remote = rep->readAll();
+  }
+  else if (rep->error() != QNetworkReply::NoError) {
+    qCritical() << "ERROR Could not fetch remote data to compare:"
+                << qPrintable(Util::getErrorString(rep->error()));
+  }
+  else {
+    qCritical() << "ERROR Could not fetch remote data to compare: HTTP code"
+                << code;
+  }
+  rep->deleteLater();
+  if (!ok) {
+    return false;
+  }
+
+  match = (remote == local);
+  if (verbose) {
+    qDebug() << "TAIL CHECK" << Range{start, end - 1}
+             << qPrintable(match ? "OK" : "MISMATCH");
+  }
   return true;
 }
 
 void Downloader::createRanges() {
-  ranges.clear();
-  chunksMap.clear();
+  // The probe data is chunk number one if it is used.
+  rangeCount = (probeData.isEmpty() ? 0 : 1);
+  nextNum = rangeCount + 1;
+  hole = 0;
+  cursor = (missing.isEmpty() ? 0 : missing.first().first);
 
   qint64 size = 1048576;
   if (chunkSize != -1) {
@@ -370,7 +1258,7 @@ void Downloader::createRanges() {
     qWarning() << "WARN Content length not known!";
     qWarning() << "WARN Falling back to single connection!";
     conns = 1;
-    ranges.enqueue(Range(0, 0));
+    rangeSize = 0;
     rangeCount = 1;
   }
   else {
@@ -387,15 +1275,13 @@ void Downloader::createRanges() {
       qDebug() << "CHUNK SIZE" << qPrintable(Util::formatSize(size, 1));
     }
 
-    for (qint64 start = offset; start < contentLen; start += size) {
-      qint64 end = start + size;
-      if (end >= contentLen) {
-        end = contentLen;
-      }
-      ranges.enqueue(Range{start, end - 1});
-      chunksMap[start] = nullptr;
+    // Ranges are produced on demand by nextRange() so only the amount
+    // is needed here.
+    if (size <= 0) size = 1;
+    rangeSize = size;
+    foreach (const auto &gap, missing) {
+      rangeCount += (gap.second - gap.first + size - 1) / size;
     }
-    rangeCount = ranges.size();
   }
 
   if (verbose) {
@@ -403,57 +1289,113 @@ void Downloader::createRanges() {
   }
 }
 
+bool Downloader::nextRange(Range &range) {
+  if (nextNum > rangeCount) {
+    return false;
+  }
+
+  // The "zero" range fetches everything when the size is unknown.
+  if (rangeSize == 0) {
+    range = Range{0, 0};
+    return true;
+  }
+
+  while (hole < missing.size() && cursor >= missing[hole].second) {
+    if (++hole < missing.size()) {
+      cursor = missing[hole].first;
+    }
+  }
+  if (hole >= missing.size()) {
+    return false;
+  }
+
+  qint64 end{qMin(cursor + rangeSize, missing[hole].second)};
+  range = Range{cursor, end - 1};
+  cursor = end;
+  return true;
+}
+
 void Downloader::setupThreadPool() {
   // Cap connections to the amount of chunks to download.
-  if (conns > ranges.size()) {
+  if (conns > rangeCount) {
     int old{conns};
-    conns = ranges.size();
+    conns = rangeCount;
     qDebug() << "Connections capped to chunks:" << old << "->" << conns;
   }
 
   pool.setMaxThreadCount(conns);
+
+  // Keep enough idle buffers around for every connection plus the ones
+  // waiting to be committed.
+  bufferPool.setMaxIdle(conns * 2);
 }
 
 void Downloader::download() {
-  // Fill queue with tasks and start immediately.
-  int num{1};
-  while (!ranges.empty()) {
-    auto range = ranges.dequeue();
-    auto *task = new DownloadTask{url, range, num++, httpUser, httpPass};
-    connect(task, SIGNAL(started(int)), SIGNAL(chunkStarted(int)));
-    connect(task, SIGNAL(progress(int, qint64, qint64)),
-            SIGNAL(chunkProgress(int, qint64, qint64)));
-    connect(task, &DownloadTask::finished,
-            this, &Downloader::onDownloadTaskFinished);
-    connect(task, &DownloadTask::failed,
-            this, &Downloader::onDownloadTaskFailed);
-    pool.start(task);
-  }
-}
-
-void Downloader::saveChunk() {
-  // Lock on chunks map is required to be acquired going into this
-  // method!
-
-  if (chunksMap.isEmpty()) {
-    // Wait for commit thread to be done.
-    return;
+  // Only one task per connection exists at a time and each one that
+  // finishes starts the next, so memory and startup time do not depend
+  // on the amount of chunks.
+  active = 0;
+  startTasks();
+
+  // The probe data was already received.
+  if (!probeData.isEmpty()) {
+    qint64 len{probeData.size()};
+    QByteArray *data;
+    if (mapping) {
+      memcpy(mapping, probeData.constData(), len);
+      data = new QByteArray(QByteArray::fromRawData(mapping, len));
+    }
+    else {
+      data = bufferPool.acquire(len);
+      data->append(probeData);
+      if (memoryBudget) {
+        memoryBudget->reserve(len);
+      }
+    }
+    probeData.clear();
+
+    emit chunkStarted(1);
+    emit chunkProgress(1, len, len);
+    commitChunk(1, Range{0, len - 1}, 0, data);
   }
+}
 
-  auto key = chunksMap.firstKey();
-  const auto *value = chunksMap[key];
-  if (value != nullptr) {
-    emit chunkToThread(value, chunksMap.size() == 1);
-    if (!commitThread.isRunning()) {
-      commitThread.start();
-    }
-    chunksMap.remove(key);
+void Downloader::startTasks() {
+  while (active < conns && startTask()) { }
+}
+
+bool Downloader::startTask() {
+  // When streaming, only request ranges close enough to what has been
+  // written that the data held back stays within the window.
+  if (sink && !sink->isPositional() && rangeSize > 0 &&
+      cursor - streamed >= streamWindow) {
+    return false;
+  }
+
+  Range range;
+  if (!nextRange(range)) {
+    return false;
   }
 
-  // If everything has been downloaded then call method again.
-  if (rangeCount == downloadCount) {
-    saveChunk();
+  auto *task = new DownloadTask{url, range, nextNum++, httpUser, httpPass};
+  task->setIfRange(ifRange);
+  task->setBufferPool(&bufferPool);
+  task->setMemoryBudget(memoryBudget);
+  if (mapping) {
+    task->setTarget(mapping + range.first);
   }
+  connect(task, SIGNAL(started(qint64)), SIGNAL(chunkStarted(qint64)));
+  connect(task, SIGNAL(progress(qint64, qint64, qint64)),
+          SIGNAL(chunkProgress(qint64, qint64, qint64)));
+  connect(task, &DownloadTask::segment,
+          this, &Downloader::onDownloadTaskSegment);
+  connect(task, &DownloadTask::finished,
+          this, &Downloader::onDownloadTaskFinished);
+  connect(task, &DownloadTask::failed,
+          this, &Downloader::onDownloadTaskFailed);
+  pool.start(task);
+  active++;
+  return true;
 }
 
 END_NAMESPACE
@@ -0,0 +1,59 @@
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+
+#include "JsonStore.h"
+
+BEGIN_NAMESPACE
+
+JsonStore::JsonStore(const QString &name, int version)
+  : dirty{false}, name{name}, version{version}
+{ }
+
+QString JsonStore::locate(QStandardPaths::StandardLocation location,
+                          const QString &fileName) {
+  QDir dir{QStandardPaths::writableLocation(location)};
+  return dir.absoluteFilePath(fileName);
+}
+
+bool JsonStore::readEntries(QJsonObject &entries) {
+  entries = QJsonObject();
+  dirty = false;
+
+  QFile file{path};
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  QJsonObject root{QJsonDocument::fromJson(file.readAll()).object()};
+  if (root["version"].toInt() != version) {
+    qWarning() << "WARN Ignoring invalid" << qPrintable(name + ":")
+               << qPrintable(path);
+    return false;
+  }
+  entries = root["entries"].toObject();
+  return true;
+}
+
+bool JsonStore::writeEntries(const QJsonObject &entries) {
+  QJsonObject root;
+  root["version"] = version;
+  root["entries"] = entries;
+
+  QDir().mkpath(QFileInfo{path}.absolutePath());
+  QSaveFile file{path};
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  file.write(QJsonDocument{root}.toJson(QJsonDocument::Compact));
+  if (!file.commit()) {
+    return false;
+  }
+  dirty = false;
+  return true;
+}
+
+END_NAMESPACE
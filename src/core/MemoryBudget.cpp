@@ -0,0 +1,57 @@
+#include <QMutexLocker>
+
+#include "MemoryBudget.h"
+
+BEGIN_NAMESPACE
+
+MemoryBudget::MemoryBudget(qint64 limit) : limit{limit}, current{0}, peak{0} { }
+
+void MemoryBudget::setLimit(qint64 limit) {
+  QMutexLocker locker{&mutex};
+  this->limit = limit;
+  released.wakeAll();
+}
+
+qint64 MemoryBudget::getLimit() const {
+  QMutexLocker locker{&mutex};
+  return limit;
+}
+
+bool MemoryBudget::acquire(qint64 bytes, int timeout) {
+  QMutexLocker locker{&mutex};
+  while (limit != -1 && current > 0 && current + bytes > limit) {
+    if (timeout < 0) {
+      released.wait(&mutex);
+    }
+    else if (!released.wait(&mutex, timeout)) {
+      return false;
+    }
+  }
+  current += bytes;
+  peak = qMax(peak, current);
+  return true;
+}
+
+void MemoryBudget::reserve(qint64 bytes) {
+  QMutexLocker locker{&mutex};
+  current += bytes;
+  peak = qMax(peak, current);
+}
+
+void MemoryBudget::release(qint64 bytes) {
+  QMutexLocker locker{&mutex};
+  current = qMax(current - bytes, qint64(0));
+  released.wakeAll();
+}
+
+qint64 MemoryBudget::getCurrent() const {
+  QMutexLocker locker{&mutex};
+  return current;
+}
+
+qint64 MemoryBudget::getPeak() const {
+  QMutexLocker locker{&mutex};
+  return peak;
+}
+
+END_NAMESPACE
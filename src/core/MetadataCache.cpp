@@ -0,0 +1,106 @@
+#include <QJsonObject>
+
+#include "MetadataCache.h"
+
+namespace {
+  const int VERSION{1};
+}
+
+BEGIN_NAMESPACE
+
+MetadataCache::MetadataCache()
+  : JsonStore{"metadata cache", VERSION}, ttl{0}
+{ }
+
+QString MetadataCache::defaultPath() {
+  return locate(QStandardPaths::CacheLocation, "metadata.json");
+}
+
+bool MetadataCache::lookup(const QUrl &url, ResourceInfo &info) const {
+  auto it = entries.find(keyFor(url));
+  if (it == entries.end() || !it->resumable || isExpired(*it)) {
+    return false;
+  }
+  info = *it;
+  return true;
+}
+
+void MetadataCache::insert(const QUrl &url, const ResourceInfo &info) {
+  if (info.getValidator().isEmpty() || !info.resumable) {
+    remove(url);
+    return;
+  }
+  entries[keyFor(url)] = info;
+  dirty = true;
+}
+
+void MetadataCache::remove(const QUrl &url) {
+  if (entries.remove(keyFor(url)) > 0) {
+    dirty = true;
+  }
+}
+
+bool MetadataCache::load() {
+  entries.clear();
+  QJsonObject list;
+  if (!readEntries(list)) {
+    return false;
+  }
+
+  for (auto it = list.constBegin(); it != list.constEnd(); ++it) {
+    QJsonObject obj{it.value().toObject()};
+    ResourceInfo info;
+    info.url = QUrl{obj["url"].toString()};
+    info.size = (qint64) obj["size"].toDouble(-1);
+    info.etag = obj["etag"].toString().toUtf8();
+    info.lastModified = obj["lastModified"].toString().toUtf8();
+    info.type = obj["type"].toString();
+    info.filename = obj["filename"].toString();
+    info.single = obj["single"].toBool(true);
+    info.resumable = obj["resumable"].toBool();
+    info.fetched =
+      QDateTime::fromMSecsSinceEpoch((qint64) obj["fetched"].toDouble());
+
+    // Expired entries, and ones without a validator written by earlier
+    // versions, are dropped on the next save.
+    if (!info.url.isValid() || isExpired(info) ||
+        info.getValidator().isEmpty()) {
+      dirty = true;
+      continue;
+    }
+    entries[it.key()] = info;
+  }
+  return true;
+}
+
+bool MetadataCache::save() {
+  if (!dirty) {
+    return true;
+  }
+
+  QJsonObject list;
+  for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+    const auto &info = it.value();
+    if (isExpired(info)) continue;
+
+    QJsonObject obj;
+    obj["url"] = info.url.toString(QUrl::FullyEncoded);
+    obj["size"] = (double) info.size;
+    obj["etag"] = QString::fromUtf8(info.etag);
+    obj["lastModified"] = QString::fromUtf8(info.lastModified);
+    obj["type"] = info.type;
+    obj["filename"] = info.filename;
+    obj["single"] = info.single;
+    obj["resumable"] = info.resumable;
+    obj["fetched"] = (double) info.fetched.toMSecsSinceEpoch();
+    list[it.key()] = obj;
+  }
+  return writeEntries(list);
+}
+
+bool MetadataCache::isExpired(const ResourceInfo &info) const {
+  return ttl <= 0 || !info.fetched.isValid() ||
+    info.fetched.secsTo(QDateTime::currentDateTime()) >= ttl;
+}
+
+END_NAMESPACE
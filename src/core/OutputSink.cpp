@@ -0,0 +1,146 @@
+#include <limits>
+#include <cstring>
+
+#include "OutputSink.h"
+
+BEGIN_NAMESPACE
+
+OutputSink::~OutputSink() { }
+
+FileSink::FileSink(const QString &path) : file{path} { }
+
+bool FileSink::open(qint64 size) {
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    setError(file.errorString());
+    return false;
+  }
+  if (size > 0 && !file.resize(size)) {
+    setError(file.errorString());
+    return false;
+  }
+  return true;
+}
+
+bool FileSink::write(qint64 pos, const QByteArray &data) {
+  if (file.pos() != pos && !file.seek(pos)) {
+    setError(file.errorString());
+    return false;
+  }
+  if (file.write(data) != data.size()) {
+    setError(file.errorString());
+    return false;
+  }
+  return true;
+}
+
+bool FileSink::finalize() {
+  bool ok{file.flush()};
+  if (!ok) {
+    setError(file.errorString());
+  }
+  file.close();
+  return ok;
+}
+
+void FileSink::abort() {
+  file.close();
+  file.remove();
+}
+
+MemorySink::MemorySink() : sized{false} { }
+
+bool MemorySink::open(qint64 size) {
+  data.clear();
+  sized = false;
+  if (size > std::numeric_limits<int>::max()) {
+    setError("Too large to keep in memory");
+    return false;
+  }
+  if (size > 0) {
+    data.resize(size);
+    sized = true;
+  }
+  return true;
+}
+
+char *MemorySink::getTarget() {
+  return (sized ? data.data() : nullptr);
+}
+
+bool MemorySink::write(qint64 pos, const QByteArray &data) {
+  qint64 end{pos + data.size()};
+  if (end > std::numeric_limits<int>::max()) {
+    setError("Too large to keep in memory");
+    return false;
+  }
+  if (end > this->data.size()) {
+    this->data.resize(end);
+  }
+  memcpy(this->data.data() + pos, data.constData(), data.size());
+  return true;
+}
+
+PipeSink::PipeSink(int fd, const QString &name) : fd{fd}, name{name} { }
+
+bool PipeSink::open(qint64 size) {
+  Q_UNUSED(size);
+  if (!file.open(fd, QIODevice::WriteOnly | QIODevice::Unbuffered,
+                 QFileDevice::DontCloseHandle)) {
+    setError(file.errorString());
+    return false;
+  }
+  return true;
+}
+
+bool PipeSink::write(qint64 pos, const QByteArray &data) {
+  Q_UNUSED(pos);
+  if (file.write(data) != data.size()) {
+    setError(file.errorString());
+    return false;
+  }
+  return true;
+}
+
+bool PipeSink::finalize() {
+  bool ok{file.flush()};
+  if (!ok) {
+    setError(file.errorString());
+  }
+  file.close();
+  return ok;
+}
+
+void PipeSink::abort() {
+  file.close();
+}
+
+CallbackSink::CallbackSink(const Callback &callback, bool positional)
+  : callback{callback}, positional{positional}
+{ }
+
+bool CallbackSink::open(qint64 size) {
+  Q_UNUSED(size);
+  return true;
+}
+
+bool CallbackSink::write(qint64 pos, const QByteArray &data) {
+  if (!callback(pos, data)) {
+    setError("Stopped by callback");
+    return false;
+  }
+  return true;
+}
+
+bool CallbackSink::finalize() {
+  if (done && !done(true)) {
+    setError("Could not be finished by callback");
+    return false;
+  }
+  return true;
+}
+
+void CallbackSink::abort() {
+  if (done) done(false);
+}
+
+END_NAMESPACE
@@ -0,0 +1,133 @@
+#include <QDataStream>
+
+#include "RangeSet.h"
+
+BEGIN_NAMESPACE
+
+RangeSet::RangeSet() : bytes{0} { }
+
+void RangeSet::add(const Range &range) {
+  if (range.second <= range.first) return;
+
+  // Merge with the preceding range if it overlaps or is adjacent.
+  qint64 start{range.first}, end{range.second};
+  auto it = map.upperBound(start);
+  if (it != map.begin()) {
+    auto prev = it;
+    --prev;
+    if (prev.value() >= start) {
+      if (prev.value() >= end) return;
+      start = prev.key();
+      bytes -= prev.value() - prev.key();
+      it = map.erase(prev);
+    }
+  }
+
+  // Then swallow all following ranges that are reached.
+  while (it != map.end() && it.key() <= end) {
+    end = qMax(end, it.value());
+    bytes -= it.value() - it.key();
+    it = map.erase(it);
+  }
+
+  map.insert(start, end);
+  bytes += end - start;
+}
+
+void RangeSet::remove(const Range &range) {
+  if (range.second <= range.first) return;
+
+  qint64 start{range.first}, end{range.second};
+  auto it = map.upperBound(start);
+  if (it != map.begin()) {
+    --it;
+    if (it.value() <= start) ++it;
+  }
+
+  // Cut every overlapping range and keep what is left on either side.
+  while (it != map.end() && it.key() < end) {
+    qint64 first{it.key()}, last{it.value()};
+    bytes -= last - first;
+    it = map.erase(it);
+    if (first < start) {
+      map.insert(first, start);
+      bytes += start - first;
+    }
+    if (last > end) {
+      map.insert(end, last);
+      bytes += last - end;
+      break;
+    }
+  }
+}
+
+void RangeSet::clear() {
+  map.clear();
+  bytes = 0;
+}
+
+bool RangeSet::contains(qint64 pos) const {
+  auto it = map.upperBound(pos);
+  if (it == map.begin()) return false;
+  --it;
+  return pos < it.value();
+}
+
+bool RangeSet::contains(const Range &range) const {
+  if (range.second <= range.first) return true;
+  auto it = map.upperBound(range.first);
+  if (it == map.begin()) return false;
+  --it;
+  return range.second <= it.value();
+}
+
+QList<Range> RangeSet::getMissing(qint64 start, qint64 end) const {
+  QList<Range> missing;
+  qint64 pos{start};
+  auto it = map.upperBound(start);
+  if (it != map.begin()) --it;
+  for (; it != map.end() && pos < end; ++it) {
+    if (it.key() > pos) {
+      missing << Range{pos, qMin(it.key(), end)};
+    }
+    pos = qMax(pos, it.value());
+  }
+  if (pos < end) {
+    missing << Range{pos, end};
+  }
+  return missing;
+}
+
+QList<Range> RangeSet::getRanges() const {
+  QList<Range> ranges;
+  for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+    ranges << Range{it.key(), it.value()};
+  }
+  return ranges;
+}
+
+END_NAMESPACE
+
+USE_NAMESPACE
+
+QDataStream &operator<<(QDataStream &stream, const RangeSet &set) {
+  stream << quint32(set.getCount());
+  foreach (const auto &range, set.getRanges()) {
+    stream << range.first << range.second;
+  }
+  return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, RangeSet &set) {
+  set.clear();
+  quint32 count;
+  stream >> count;
+  for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+    qint64 start, end;
+    stream >> start >> end;
+    if (stream.status() == QDataStream::Ok) {
+      set.add(Range{start, end});
+    }
+  }
+  return stream;
+}
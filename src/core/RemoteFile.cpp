@@ -0,0 +1,276 @@
+#include <QVector>
+#include <QEventLoop>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+#include <limits>
+
+#include "Util.h"
+#include "RemoteFile.h"
+#include "DownloadTask.h"
+
+namespace {
+  const int MAX_REDIRECTS{20};
+
+  // Cached blocks between missing ones are fetched again if it saves a
+  // request.
+  const qint64 MAX_GAP{1}; // blocks
+}
+
+BEGIN_NAMESPACE
+
+RemoteFile::RemoteFile(const QUrl &url)
+  : url{url}, size{-1}, blockSize{262144}, maxReadahead{8388608},
+    readahead{0}, lastEnd{-1}, requests{0}, hits{0}, misses{0}
+{
+  setCacheSize(67108864); // 64 MB
+
+  // Tasks report back across threads.
+  Util::registerCustomTypes();
+}
+
+void RemoteFile::setHttpCredentials(const QString &user,
+                                    const QString &pass) {
+  httpUser = user;
+  httpPass = pass;
+}
+
+void RemoteFile::setBlockSize(qint64 size) {
+  blockSize = qBound(qint64(1), size, qint64(DownloadTask::MAX_SEGMENT));
+  cache.clear();
+}
+
+void RemoteFile::setCacheSize(qint64 bytes) {
+  // The cost of each block is its size.
+  cache.setMaxCost(qMin(bytes, qint64(std::numeric_limits<int>::max())));
+}
+
+bool RemoteFile::open() {
+  error.clear();
+  QUrl loc{url};
+  for (int redirects = 0;; redirects++) {
+    // Only the first byte is needed to know if ranges are supported and
+    // to get the size.
+    QNetworkRequest req{loc};
+    req.setRawHeader("Range", "bytes=0-0");
+    req.setRawHeader("Accept-Encoding", "identity");
+    if (!httpUser.isEmpty() && !httpPass.isEmpty()) {
+      req.setRawHeader("Authorization",
+                       Util::createHttpAuthHeader(httpUser, httpPass));
+    }
+
+    auto *rep = netmgr.get(req);
+    QEventLoop loop;
+    connect(rep, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+
+    // Stop as soon as the status is known to be wrong, since a server
+    // ignoring the range sends the whole file.
+    bool wrongStatus{false};
+    connect(rep, &QNetworkReply::metaDataChanged, &loop, [&] {
+      int code =
+        rep->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+      if (!wrongStatus && code != 0 && code != 206 &&
+          (code < 300 || code >= 400)) {
+        wrongStatus = true;
+        rep->abort();
+      }
+    });
+    loop.exec();
+    rep->deleteLater();
+    requests++;
+
+    int code = rep->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (wrongStatus) {
+      if (code >= 200 && code < 300) {
+        error = "Server does not support ranges";
+      }
+      else {
+        QString reason{rep->attribute(
+          QNetworkRequest::HttpReasonPhraseAttribute).toString()};
+        error = QString("HTTP code %1: %2").arg(code).arg(reason);
+      }
+      return false;
+    }
+    if (code >= 300 && code < 400 && rep->hasRawHeader("Location")) {
+      if (redirects >= MAX_REDIRECTS) {
+        error = "Too many redirections";
+        return false;
+      }
+      QUrl next{QString::fromUtf8(rep->rawHeader("Location"))};
+      loc = (next.isRelative() ? rep->url().resolved(next) : next);
+      continue;
+    }
+
+    if (rep->error() != QNetworkReply::NoError) {
+      error = Util::getErrorString(rep->error());
+      return false;
+    }
+    if (code != 206) {
+      error = "Server does not support ranges";
+      return false;
+    }
+
+    // "bytes 0-0/<size>"
+    bool ok;
+    QString range{QString::fromUtf8(rep->rawHeader("Content-Range"))};
+    qint64 total{range.section('/', 1).toLongLong(&ok)};
+    if (!ok || total <= 0) {
+      error = "Unknown size";
+      return false;
+    }
+
+    // Weak entity tags cannot be used with If-Range.
+    QByteArray etag{rep->rawHeader("ETag")};
+    validator = (!etag.isEmpty() && !etag.startsWith("W/")
+                 ? etag : rep->rawHeader("Last-Modified"));
+
+    url = loc;
+    size = total;
+    readahead = 0;
+    lastEnd = -1;
+    cache.clear();
+    return true;
+  }
+}
+
+QByteArray RemoteFile::read(qint64 offset, qint64 len) {
+  error.clear();
+  if (size == -1) {
+    error = "Not open";
+    return QByteArray();
+  }
+  if (offset < 0 || offset >= size || len <= 0) {
+    return QByteArray();
+  }
+  len = qMin(len, size - offset);
+  if (len > std::numeric_limits<int>::max()) {
+    error = "Too much to read at once";
+    return QByteArray();
+  }
+
+  // Reads continuing where the last one ended fetch more and more ahead.
+  if (offset == lastEnd && maxReadahead > 0) {
+    readahead = qMin(qMax(readahead * 2, blockSize), maxReadahead);
+  }
+  else {
+    readahead = 0;
+  }
+  lastEnd = offset + len;
+
+  qint64 first{offset / blockSize}, last{(offset + len - 1) / blockSize},
+    fetchLast{qMin((offset + len - 1 + readahead) / blockSize,
+                   (size - 1) / blockSize)};
+
+  // Take what is cached and group the rest into runs of blocks that are
+  // fetched with one request each.
+  QMap<qint64, QByteArray> blocks;
+  QList<Range> runs; // first and last block
+  for (qint64 num = first; num <= fetchLast; num++) {
+    const auto *block = cache.object(num);
+    if (block) {
+      if (num <= last) {
+        blocks[num] = *block;
+        hits++;
+      }
+      continue;
+    }
+    if (num <= last) {
+      misses++;
+    }
+    if (!runs.isEmpty() && num - runs.last().second <= MAX_GAP + 1 &&
+        (num - runs.last().first + 1) * blockSize <=
+        DownloadTask::MAX_SEGMENT) {
+      runs.last().second = num;
+    }
+    else {
+      runs << Range{num, num};
+    }
+  }
+  if (!runs.isEmpty() && !fetch(runs, blocks)) {
+    return QByteArray();
+  }
+
+  QByteArray data;
+  data.reserve(len);
+  for (qint64 num = first; num <= last; num++) {
+    const QByteArray &block = blocks[num];
+    qint64 start{num * blockSize},
+      from{qMax(offset, start) - start},
+      to{qMin(offset + len, start + block.size()) - start};
+    data.append(block.constData() + from, to - from);
+  }
+  return data;
+}
+
+bool RemoteFile::fetch(const QList<Range> &runs,
+                       QMap<qint64, QByteArray> &blocks) {
+  // Fetch all runs at the same time, each directly into its own buffer.
+  QVector<QByteArray> buffers(runs.size());
+  QEventLoop loop;
+  int pending{runs.size()};
+  bool changed{false};
+  for (int i = 0; i < runs.size(); i++) {
+    Range range{runs[i].first * blockSize,
+        qMin((runs[i].second + 1) * blockSize, size) - 1};
+    buffers[i].resize(range.second - range.first + 1);
+
+    auto *task = new DownloadTask{url, range, i, httpUser, httpPass};
+    task->setIfRange(validator);
+    task->setTarget(buffers[i].data());
+
+    // Only views of the buffer are passed on.
+    connect(task, &DownloadTask::segment, this,
+            [](qint64, qint64, QByteArray *data) { delete data; });
+    connect(task, &DownloadTask::finished, this,
+            [&](qint64, Range range, qint64 pos, QByteArray *data) {
+              // The rest of the buffer would be zeros otherwise.
+              qint64 end{pos + data->size()};
+              delete data;
+              if (end != range.second + 1) {
+                error = QString("Received %1 of %2 bytes")
+                  .arg(end - range.first).arg(range.second - range.first + 1);
+              }
+              if (--pending == 0) loop.quit();
+            });
+    connect(task, &DownloadTask::failed, this,
+            [&](qint64, Range, int httpCode,
+                QNetworkReply::NetworkError netError) {
+              if (httpCode == 200) {
+                changed = true;
+                error = "Remote file changed";
+              }
+              else {
+                error = QString("HTTP code %1: %2").arg(httpCode)
+                  .arg(Util::getErrorString(netError));
+              }
+              if (--pending == 0) loop.quit();
+            });
+    connect(task, &QThread::finished, task, &QObject::deleteLater);
+    task->start();
+    requests++;
+  }
+  if (pending > 0) {
+    loop.exec();
+  }
+
+  if (!error.isEmpty()) {
+    if (changed) {
+      cache.clear();
+    }
+    return false;
+  }
+
+  // Split the runs into blocks. Runs of one block are used as they are.
+  for (int i = 0; i < runs.size(); i++) {
+    qint64 pos{0};
+    for (qint64 num = runs[i].first; num <= runs[i].second; num++) {
+      QByteArray block{buffers[i].mid(pos, blockSize)};
+      pos += block.size();
+      cache.insert(num, new QByteArray(block), block.size());
+      blocks[num] = block;
+    }
+  }
+  return true;
+}
+
+END_NAMESPACE
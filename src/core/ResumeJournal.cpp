@@ -0,0 +1,151 @@
+#include <QFile>
+#include <QDebug>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QMutexLocker>
+
+#include "ResumeJournal.h"
+
+namespace {
+  const quint32 MAGIC{0x4546444c}; // "EFDL"
+  const quint32 VERSION{2};
+}
+
+BEGIN_NAMESPACE
+
+ResumeJournal::ResumeJournal() : contentLen{-1} { }
+
+QString ResumeJournal::pathFor(const QString &outputPath) {
+  return outputPath + ".efdl";
+}
+
+void ResumeJournal::setContentLength(qint64 len) {
+  QMutexLocker locker{&mutex};
+  contentLen = len;
+}
+
+qint64 ResumeJournal::getContentLength() const {
+  QMutexLocker locker{&mutex};
+  return contentLen;
+}
+
+void ResumeJournal::setETag(const QByteArray &etag) {
+  QMutexLocker locker{&mutex};
+  this->etag = etag;
+}
+
+QByteArray ResumeJournal::getETag() const {
+  QMutexLocker locker{&mutex};
+  return etag;
+}
+
+void ResumeJournal::setLastModified(const QByteArray &lastModified) {
+  QMutexLocker locker{&mutex};
+  this->lastModified = lastModified;
+}
+
+QByteArray ResumeJournal::getLastModified() const {
+  QMutexLocker locker{&mutex};
+  return lastModified;
+}
+
+void ResumeJournal::addRange(const Range &range) {
+  if (range.second <= range.first) return;
+
+  QMutexLocker locker{&mutex};
+  ranges.add(range);
+}
+
+QList<Range> ResumeJournal::getRanges() const {
+  QMutexLocker locker{&mutex};
+  return ranges.getRanges();
+}
+
+QList<Range> ResumeJournal::getMissing() const {
+  QMutexLocker locker{&mutex};
+  if (contentLen == -1) {
+    return QList<Range>();
+  }
+  return ranges.getMissing(0, contentLen);
+}
+
+qint64 ResumeJournal::getBytesDone() const {
+  QMutexLocker locker{&mutex};
+  return ranges.getBytes();
+}
+
+bool ResumeJournal::isComplete() const {
+  return getContentLength() != -1 && getMissing().isEmpty();
+}
+
+void ResumeJournal::clear() {
+  QMutexLocker locker{&mutex};
+  contentLen = -1;
+  etag.clear();
+  lastModified.clear();
+  ranges.clear();
+}
+
+bool ResumeJournal::exists() const {
+  return !path.isEmpty() && QFile::exists(path);
+}
+
+bool ResumeJournal::load() {
+  clear();
+
+  QFile file{path};
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  QDataStream stream{&file};
+  quint32 magic, version;
+  stream >> magic >> version;
+  if (magic != MAGIC || version != VERSION) {
+    qWarning() << "WARN Ignoring invalid resume journal:" << qPrintable(path);
+    return false;
+  }
+
+  qint64 len;
+  QByteArray tag, modified;
+  RangeSet set;
+  stream >> len >> tag >> modified >> set;
+  if (stream.status() != QDataStream::Ok) {
+    qWarning() << "WARN Ignoring truncated resume journal:" << qPrintable(path);
+    return false;
+  }
+
+  QMutexLocker locker{&mutex};
+  contentLen = len;
+  etag = tag;
+  lastModified = modified;
+  ranges = set;
+  return true;
+}
+
+bool ResumeJournal::save() {
+  QMutexLocker locker{&mutex};
+
+  // Written to a temporary file and renamed on commit.
+  QSaveFile file{path};
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+
+  QDataStream stream{&file};
+  stream << MAGIC << VERSION << contentLen << etag << lastModified << ranges;
+  if (stream.status() != QDataStream::Ok) {
+    file.cancelWriting();
+    return false;
+  }
+  return file.commit();
+}
+
+bool ResumeJournal::remove() {
+  if (!exists()) {
+    return true;
+  }
+  return QFile::remove(path);
+}
+
+END_NAMESPACE
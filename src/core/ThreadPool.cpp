@@ -25,6 +25,7 @@ void ThreadPool::start(DownloadTask *task) {
 void ThreadPool::stop() {
   {
     QMutexLocker locker(&taskMutex);
+    qDeleteAll(tasks);
     tasks.clear();
   }
 
@@ -51,6 +52,7 @@ void ThreadPool::onTaskFinished() {
     QMutexLocker locker(&runMutex);
     running.removeAll(task);
   }
+  task->deleteLater();
   startTask();
 }
 
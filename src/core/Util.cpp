@@ -12,6 +12,17 @@
   #define isATty isatty
 #endif
 
+#ifndef WIN32
+  #include <errno.h>
+  #include <fcntl.h> // fallocate(), fcntl()
+  #include <string.h> // strerror()
+#endif
+
+#ifdef Q_OS_LINUX
+  #include <sys/ioctl.h> // ioctl()
+  #include <linux/fs.h> // FICLONE
+#endif
+
 #include "Util.h"
 #include "Range.h"
 
@@ -227,7 +238,8 @@ QByteArray Util::createHttpAuthHeader(const QString &user,
 }
 
 QByteArray Util::hashFile(const QString &path,
-                          const QCryptographicHash::Algorithm &alg) {
+                          const QCryptographicHash::Algorithm &alg,
+                          bool dropCache) {
   QCryptographicHash hasher{alg};
   QFile file{path};
   if (!file.open(QIODevice::ReadOnly)) {
@@ -235,11 +247,115 @@ QByteArray Util::hashFile(const QString &path,
                 << "file for reading.";
     return QByteArray();
   }
-  if (!hasher.addData(&file)) {
-    qCritical() << "ERROR Failed to do checksum of file.";
-    return QByteArray();
+
+  if (!dropCache) {
+    if (!hasher.addData(&file)) {
+      qCritical() << "ERROR Failed to do checksum of file.";
+      return QByteArray();
+    }
+    return hasher.result().toHex();
+  }
+
+  // Read sequentially and drop what has been hashed from the page cache
+  // as it goes.
+#ifdef Q_OS_LINUX
+  posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(Q_OS_MAC)
+  fcntl(file.handle(), F_NOCACHE, 1);
+#endif
+
+  constexpr qint64 BLOCK{8388608}; // 8 MB
+  QByteArray block;
+  qint64 pos{0};
+  while (!file.atEnd()) {
+    block = file.read(BLOCK);
+    if (block.isEmpty()) {
+      qCritical() << "ERROR Failed to do checksum of file.";
+      return QByteArray();
+    }
+    hasher.addData(block);
+#ifdef Q_OS_LINUX
+    posix_fadvise(file.handle(), pos, block.size(), POSIX_FADV_DONTNEED);
+#endif
+    pos += block.size();
   }
   return hasher.result().toHex();
 }
 
+bool Util::preallocateFile(QFile &file, qint64 size) {
+  if (file.size() >= size) {
+    return true;
+  }
+
+#if defined(Q_OS_LINUX)
+  // Allocate the extent without writing anything. If the file system
+  // does not support it then fall back to a sparse file.
+  if (fallocate(file.handle(), 0, 0, size) == 0) {
+    return true;
+  }
+  if (errno == ENOSPC || errno == EFBIG) {
+    qCritical() << "ERROR Could not allocate"
+                << qPrintable(Util::formatSize(size, 1)) << "for output file:"
+                << strerror(errno);
+    return false;
+  }
+#elif defined(Q_OS_MAC)
+  // Try a contiguous allocation first and otherwise any allocation.
+  fstore_t store{F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size - file.size(), 0};
+  if (fcntl(file.handle(), F_PREALLOCATE, &store) == -1) {
+    store.fst_flags = F_ALLOCATEALL;
+    if (fcntl(file.handle(), F_PREALLOCATE, &store) == -1 && errno == ENOSPC) {
+      qCritical() << "ERROR Could not allocate"
+                  << qPrintable(Util::formatSize(size, 1)) << "for output file:"
+                  << strerror(errno);
+      return false;
+    }
+  }
+#endif
+
+  if (!file.resize(size)) {
+    qCritical() << "ERROR Could not resize output file:"
+                << qPrintable(file.errorString());
+    return false;
+  }
+  return true;
+}
+
+bool Util::cloneFile(const QString &src, const QString &dst, bool allowLink,
+                     bool *linked) {
+  if (linked) {
+    *linked = false;
+  }
+  if (QFile::exists(dst) && !QFile::remove(dst)) {
+    return false;
+  }
+
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+  {
+    QFile in{src}, out{dst};
+    if (in.open(QIODevice::ReadOnly) && out.open(QIODevice::WriteOnly)) {
+      if (ioctl(out.handle(), FICLONE, in.handle()) == 0) {
+        return true;
+      }
+      out.close();
+      QFile::remove(dst);
+    }
+  }
+#endif
+
+#ifndef WIN32
+  if (allowLink && link(QFile::encodeName(src).constData(),
+                        QFile::encodeName(dst).constData()) == 0) {
+    if (linked) {
+      *linked = true;
+    }
+    return true;
+  }
+#else
+  Q_UNUSED(allowLink);
+#endif
+
+  return QFile::copy(src, dst);
+}
+
 END_NAMESPACE
@@ -0,0 +1,82 @@
+#include <QFileInfo>
+#include <QJsonObject>
+
+#include "ValidatorStore.h"
+
+namespace {
+  const int VERSION{1};
+}
+
+BEGIN_NAMESPACE
+
+ValidatorStore::ValidatorStore() : JsonStore{"validator store", VERSION} { }
+
+QString ValidatorStore::defaultPath() {
+  return locate(QStandardPaths::DataLocation, "validators.json");
+}
+
+bool ValidatorStore::lookup(const QUrl &url, Entry &entry) const {
+  auto it = entries.find(keyFor(url));
+  if (it == entries.end()) {
+    return false;
+  }
+  QFileInfo fi{it->path};
+  if (!fi.exists() || fi.size() != it->size) {
+    return false;
+  }
+  entry = *it;
+  return true;
+}
+
+void ValidatorStore::insert(const QUrl &url, const Entry &entry) {
+  entries[keyFor(url)] = entry;
+  dirty = true;
+}
+
+void ValidatorStore::remove(const QUrl &url) {
+  if (entries.remove(keyFor(url)) > 0) {
+    dirty = true;
+  }
+}
+
+bool ValidatorStore::load() {
+  entries.clear();
+  QJsonObject list;
+  if (!readEntries(list)) {
+    return false;
+  }
+
+  for (auto it = list.constBegin(); it != list.constEnd(); ++it) {
+    QJsonObject obj{it.value().toObject()};
+    Entry entry;
+    entry.path = obj["path"].toString();
+    entry.size = (qint64) obj["size"].toDouble(-1);
+    entry.etag = obj["etag"].toString().toUtf8();
+    entry.lastModified = obj["lastModified"].toString().toUtf8();
+    entry.recorded =
+      QDateTime::fromMSecsSinceEpoch((qint64) obj["recorded"].toDouble());
+    entries[it.key()] = entry;
+  }
+  return true;
+}
+
+bool ValidatorStore::save() {
+  if (!dirty) {
+    return true;
+  }
+
+  QJsonObject list;
+  for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+    const auto &entry = it.value();
+    QJsonObject obj;
+    obj["path"] = entry.path;
+    obj["size"] = (double) entry.size;
+    obj["etag"] = QString::fromUtf8(entry.etag);
+    obj["lastModified"] = QString::fromUtf8(entry.lastModified);
+    obj["recorded"] = (double) entry.recorded.toMSecsSinceEpoch();
+    list[it.key()] = obj;
+  }
+  return writeEntries(list);
+}
+
+END_NAMESPACE
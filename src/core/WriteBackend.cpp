@@ -0,0 +1,402 @@
+#include <QHash>
+#include <QFile>
+#include <QVector>
+
+#ifndef WIN32
+  #include <errno.h>
+  #include <string.h> // strerror()
+  #include <unistd.h> // pwrite()
+  #include <sys/uio.h> // pwritev(), iovec
+#endif
+
+#ifdef HAVE_IO_URING
+  #include <liburing.h>
+#endif
+
+#include "OutputSink.h"
+#include "WriteBackend.h"
+
+BEGIN_NAMESPACE
+
+namespace {
+#ifndef WIN32
+  QVector<iovec> toIovecs(const QList<WriteBackend::Request> &group,
+                          qint64 skip = 0) {
+    QVector<iovec> iov;
+    iov.reserve(group.size());
+    foreach (const auto &request, group) {
+      const auto *data = request.second;
+      if (skip >= data->size()) {
+        skip -= data->size();
+        continue;
+      }
+      iovec vec;
+      vec.iov_base = const_cast<char*>(data->constData()) + skip;
+      vec.iov_len = data->size() - skip;
+      iov << vec;
+      skip = 0;
+    }
+    return iov;
+  }
+#endif
+
+  class FileBackend : public WriteBackend {
+  public:
+    FileBackend(QFile *file) : WriteBackend(file) { }
+
+    QString getName() const override { return "qfile"; }
+
+    bool submit(const QList<Request> &group) override {
+      qint64 pos{group.first().first};
+      if (file->pos() != pos) {
+        syscalls++;
+        if (!file->seek(pos)) {
+          setError(file->errorString());
+          return false;
+        }
+      }
+      foreach (const auto &request, group) {
+        const auto *data = request.second;
+        syscalls++;
+        if (file->write(*data) != data->size()) {
+          setError(file->errorString());
+          return false;
+        }
+        written += data->size();
+      }
+      done << group;
+      return true;
+    }
+
+    QList<Request> reap(bool wait) override {
+      if (wait) {
+        file->flush();
+      }
+      QList<Request> res;
+      res.swap(done);
+      return res;
+    }
+
+  private:
+    QList<Request> done;
+  };
+
+  class SinkBackend : public WriteBackend {
+  public:
+    SinkBackend(OutputSink *sink) : WriteBackend(nullptr), sink{sink} { }
+
+    QString getName() const override { return "sink"; }
+
+    bool submit(const QList<Request> &group) override {
+      foreach (const auto &request, group) {
+        const auto *data = request.second;
+        syscalls++;
+        if (!sink->write(request.first, *data)) {
+          setError(sink->getError());
+          return false;
+        }
+        written += data->size();
+      }
+      done << group;
+      return true;
+    }
+
+    QList<Request> reap(bool wait) override {
+      Q_UNUSED(wait);
+      QList<Request> res;
+      res.swap(done);
+      return res;
+    }
+
+  private:
+    OutputSink *sink;
+    QList<Request> done;
+  };
+
+#ifndef WIN32
+  class PwriteBackend : public WriteBackend {
+  public:
+    PwriteBackend(QFile *file) : WriteBackend(file) { }
+
+    QString getName() const override { return "pwrite"; }
+
+    bool submit(const QList<Request> &group) override {
+      if (!writeAll(group)) {
+        return false;
+      }
+      done << group;
+      return true;
+    }
+
+    QList<Request> reap(bool wait) override {
+      Q_UNUSED(wait);
+      QList<Request> res;
+      res.swap(done);
+      return res;
+    }
+
+  private:
+    QList<Request> done;
+  };
+#endif
+
+#ifdef HAVE_IO_URING
+  class UringBackend : public WriteBackend {
+  public:
+    UringBackend(QFile *file)
+      : WriteBackend(file), nextId{0}, unsubmitted{0}, inFlight{0}
+    {
+      ok = (io_uring_queue_init(QUEUE_DEPTH, &ring, 0) == 0);
+    }
+
+    ~UringBackend() {
+      if (ok) {
+        // The kernel might still read from the buffers of writes in
+        // flight, even after an error, so wait for all of them before the
+        // buffers can be released.
+        while (inFlight > 0) {
+          struct io_uring_cqe *cqe{nullptr};
+          int res = io_uring_wait_cqe(&ring, &cqe);
+          if (res == -EINTR) continue;
+          if (res < 0) break;
+          delete pending.take(cqe->user_data);
+          io_uring_cqe_seen(&ring, cqe);
+          inFlight--;
+        }
+        io_uring_queue_exit(&ring);
+      }
+      qDeleteAll(pending);
+    }
+
+    bool isOk() const { return ok; }
+
+    QString getName() const override { return "io_uring"; }
+
+    bool submit(const QList<Request> &group) override {
+      // Never have more operations than the completion queue can hold,
+      // or completions might overflow and be lost.
+      if (pending.size() >= int(QUEUE_DEPTH)) {
+        submitPending();
+        complete(1);
+        if (hasError()) {
+          return false;
+        }
+      }
+
+      auto *sqe = io_uring_get_sqe(&ring);
+      if (!sqe) {
+        // Submission queue is full so hand the batch to the kernel.
+        submitPending();
+        sqe = io_uring_get_sqe(&ring);
+        if (!sqe) {
+          setError("io_uring submission queue is full");
+          return false;
+        }
+      }
+
+      // The vectors must stay valid until the write has completed.
+      auto *op = new Operation;
+      op->group = group;
+      op->iov = toIovecs(group);
+      io_uring_prep_writev(sqe, file->handle(), op->iov.constData(),
+                           op->iov.size(), group.first().first);
+      sqe->user_data = nextId;
+      pending[nextId++] = op;
+      unsubmitted++;
+      return true;
+    }
+
+    QList<Request> reap(bool wait) override {
+      submitPending();
+      complete(wait ? inFlight : 0);
+      QList<Request> res;
+      res.swap(done);
+      return res;
+    }
+
+  private:
+    struct Operation {
+      QList<Request> group;
+      QVector<iovec> iov;
+    };
+
+    // Takes the operations that have completed, waiting for at least
+    // the given amount.
+    void complete(int min) {
+      while (inFlight > 0 && !hasError()) {
+        struct io_uring_cqe *cqe{nullptr};
+        int res = io_uring_peek_cqe(&ring, &cqe);
+        if (res == -EAGAIN) {
+          if (min <= 0) break;
+          syscalls++;
+          res = io_uring_wait_cqe(&ring, &cqe);
+        }
+        if (res == -EINTR) continue;
+        if (res < 0) {
+          setError(strerror(-res));
+          break;
+        }
+
+        auto *op = pending.take(cqe->user_data);
+        int wrote = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        inFlight--;
+        min--;
+
+        if (wrote < 0) {
+          setError(strerror(-wrote));
+          delete op;
+          break;
+        }
+        written += wrote;
+
+        // Short writes are rare so finish them synchronously.
+        qint64 total{0};
+        foreach (const auto &request, op->group) {
+          total += request.second->size();
+        }
+        if (wrote < total && !writeAll(op->group, wrote)) {
+          delete op;
+          break;
+        }
+        done << op->group;
+        delete op;
+      }
+    }
+
+    void submitPending() {
+      if (unsubmitted == 0) return;
+      syscalls++;
+      int res = io_uring_submit(&ring);
+      if (res < 0) {
+        setError(strerror(-res));
+        return;
+      }
+      inFlight += res;
+      unsubmitted -= res;
+    }
+
+    static constexpr unsigned QUEUE_DEPTH{64};
+
+    bool ok;
+    struct io_uring ring;
+    quint64 nextId;
+    int unsubmitted, inFlight; // prepared and submitted operations
+    QHash<quint64, Operation*> pending; // id -> operation
+    QList<Request> done;
+  };
+#endif
+}
+
+WriteBackend::WriteBackend(QFile *file) : file{file}, syscalls{0}, written{0} { }
+
+WriteBackend::~WriteBackend() { }
+
+WriteBackend *WriteBackend::create(Type type, QFile *file) {
+#ifdef HAVE_IO_URING
+  if (type == Type::Auto || type == Type::IoUring) {
+    auto *backend = new UringBackend(file);
+    if (backend->isOk()) {
+      return backend;
+    }
+    // Kernel does not support io_uring or it is not permitted.
+    delete backend;
+  }
+#endif
+
+#ifndef WIN32
+  if (type != Type::File) {
+    return new PwriteBackend(file);
+  }
+#endif
+
+  return new FileBackend(file);
+}
+
+WriteBackend *WriteBackend::create(OutputSink *sink) {
+  return new SinkBackend(sink);
+}
+
+bool WriteBackend::stringToType(QString str, Type &type) {
+  str = str.trimmed().toLower();
+  if (str == "auto") {
+    type = Type::Auto;
+  }
+  else if (str == "qfile") {
+    type = Type::File;
+  }
+  else if (str == "pwrite") {
+    type = Type::Pwrite;
+  }
+  else if (str == "io_uring") {
+    type = Type::IoUring;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+bool WriteBackend::writeAll(const QList<Request> &group, qint64 skip) {
+  qint64 pos{group.first().first + skip};
+
+#ifndef WIN32
+  auto iov = toIovecs(group, skip);
+  int idx{0};
+  while (idx < iov.size()) {
+    syscalls++;
+#ifdef Q_OS_LINUX
+    ssize_t res = pwritev(file->handle(), iov.constData() + idx,
+                          iov.size() - idx, pos);
+#else
+    ssize_t res = pwrite(file->handle(), iov[idx].iov_base, iov[idx].iov_len,
+                         pos);
+#endif
+    if (res == -1) {
+      if (errno == EINTR) continue;
+      setError(strerror(errno));
+      return false;
+    }
+    pos += res;
+    written += res;
+
+    // Advance past what was written.
+    while (res > 0 && idx < iov.size()) {
+      if (size_t(res) >= iov[idx].iov_len) {
+        res -= iov[idx].iov_len;
+        idx++;
+      }
+      else {
+        iov[idx].iov_base = static_cast<char*>(iov[idx].iov_base) + res;
+        iov[idx].iov_len -= res;
+        res = 0;
+      }
+    }
+  }
+  return true;
+#else
+  syscalls++;
+  if (!file->seek(pos)) {
+    setError(file->errorString());
+    return false;
+  }
+  foreach (const auto &request, group) {
+    const auto *data = request.second;
+    if (skip >= data->size()) {
+      skip -= data->size();
+      continue;
+    }
+    syscalls++;
+    qint64 len{data->size() - skip};
+    if (file->write(data->constData() + skip, len) != len) {
+      setError(file->errorString());
+      return false;
+    }
+    written += len;
+    skip = 0;
+  }
+  return true;
+#endif
+}
+
+END_NAMESPACE
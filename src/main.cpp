@@ -3,16 +3,26 @@
 #include <QDebug>
 #include <QTimer>
 #include <QTextStream>
+#include <QNetworkAccessManager>
 #include <QCoreApplication>
 #include <QCommandLineParser>
 
+#include <cstdio>
 #include <signal.h>
 
 #include "Util.h"
 #include "Version.h"
 #include "Downloader.h"
+#include "OutputSink.h"
+#include "MemoryBudget.h"
+#include "DownloadCache.h"
+#include "MetadataCache.h"
+#include "ValidatorStore.h"
+#include "WriteBackend.h"
 USE_NAMESPACE
 
+#include "Daemon.h"
+#include "LineReader.h"
 #include "DownloadManager.h"
 
 void signalHandler(int sig) {
@@ -33,12 +43,9 @@ int main(int argc, char **argv) {
   signal(SIGKILL, signalHandler);
 #endif
 
-  // Read possible URLs from STDIN.
-  QString pipeIn;
-  if (Util::isStdinPipe()) {
-    QTextStream stream(stdin, QIODevice::ReadOnly);
-    pipeIn = stream.readAll();
-  }
+  // Possible URLs from STDIN.
+  bool stdinPipe{Util::isStdinPipe()};
+  QTextStream input(stdin, QIODevice::ReadOnly);
 
   QCommandLineParser parser;
   parser.setApplicationDescription(QObject::tr("Efficient downloading application.") +
@@ -66,6 +73,13 @@ int main(int argc, char **argv) {
                               QObject::tr("dir"));
   parser.addOption(outputOpt);
 
+  QCommandLineOption outputFileOpt(QStringList{"O", "output-file"},
+                                   QObject::tr("Save to this file instead, or "
+                                               "write to STDOUT in order if "
+                                               "'-'."),
+                                   QObject::tr("file"));
+  parser.addOption(outputFileOpt);
+
   QCommandLineOption connsOpt(QStringList{"c", "conns"},
                               QObject::tr("Number of simultaneous connections to"
                                           " use. (defaults to 1)"),
@@ -77,6 +91,121 @@ int main(int argc, char **argv) {
                                             "locally and the server supports it."));
   parser.addOption(resumeOpt);
 
+  QCommandLineOption resumeCheckOpt(QStringList{"resume-check"},
+                                    QObject::tr("Re-download the given amount of "
+                                                "bytes before the resume offset "
+                                                "and compare them with the local "
+                                                "data before resuming."),
+                                    QObject::tr("bytes"));
+  parser.addOption(resumeCheckOpt);
+
+  QCommandLineOption noPreallocOpt(QStringList{"no-preallocate"},
+                                   QObject::tr("Do not reserve disk space for "
+                                               "the entire file before "
+                                               "downloading."));
+  parser.addOption(noPreallocOpt);
+
+  QCommandLineOption writeBackendOpt(QStringList{"write-backend"},
+                                     QObject::tr("How chunks are written to disk:"
+                                                 " auto, io_uring, pwrite or "
+                                                 "qfile. (defaults to auto)"),
+                                     QObject::tr("name"));
+  parser.addOption(writeBackendOpt);
+
+  QCommandLineOption writeCoalesceOpt(QStringList{"write-coalesce"},
+                                      QObject::tr("Write adjacent chunks "
+                                                  "together up to this amount "
+                                                  "of bytes. 0 disables it. "
+                                                  "(defaults to 4 MB)"),
+                                      QObject::tr("bytes"));
+  parser.addOption(writeCoalesceOpt);
+
+  QCommandLineOption mmapOpt(QStringList{"mmap"},
+                             QObject::tr("Receive data directly into a memory "
+                                         "mapping of the output file instead "
+                                         "of writing it. Requires a known file "
+                                         "size."));
+  parser.addOption(mmapOpt);
+
+  QCommandLineOption dropCacheOpt(QStringList{"drop-cache"},
+                                  QObject::tr("Keep the output out of the page "
+                                              "cache while writing and hashing "
+                                              "it. Useful for very large files."));
+  parser.addOption(dropCacheOpt);
+
+  QCommandLineOption maxMemoryOpt(QStringList{"max-memory"},
+                                  QObject::tr("Maximum amount of downloaded "
+                                              "data to hold in memory before "
+                                              "connections are paused."),
+                                  QObject::tr("bytes"));
+  parser.addOption(maxMemoryOpt);
+
+  QCommandLineOption syncEveryOpt(QStringList{"sync-every"},
+                                  QObject::tr("Sync the output to disk every "
+                                              "time this amount of bytes has "
+                                              "been written, and only then "
+                                              "record it as resumable."),
+                                  QObject::tr("bytes"));
+  parser.addOption(syncEveryOpt);
+
+  QCommandLineOption syncIntervalOpt(QStringList{"sync-interval"},
+                                     QObject::tr("Sync the output to disk at "
+                                                 "most this many seconds apart, "
+                                                 "and only then record it as "
+                                                 "resumable."),
+                                     QObject::tr("secs"));
+  parser.addOption(syncIntervalOpt);
+
+  QCommandLineOption cacheDirOpt(QStringList{"cache-dir"},
+                                 QObject::tr("Share downloaded files through "
+                                             "a local cache in this directory "
+                                             "instead of downloading them "
+                                             "again."),
+                                 QObject::tr("dir"));
+  parser.addOption(cacheDirOpt);
+
+  QCommandLineOption cacheSizeOpt(QStringList{"cache-size"},
+                                  QObject::tr("Maximum size of the cache "
+                                              "directory. Least recently used "
+                                              "files are evicted first."),
+                                  QObject::tr("bytes"));
+  parser.addOption(cacheSizeOpt);
+
+  QCommandLineOption cacheLinksOpt(QStringList{"cache-links"},
+                                   QObject::tr("Hard link files from the cache "
+                                               "where they cannot be "
+                                               "reflinked. Such files are "
+                                               "read-only."));
+  parser.addOption(cacheLinksOpt);
+
+  QCommandLineOption dedupeOpt(QStringList{"dedupe"},
+                               QObject::tr("Wait for other efdl processes "
+                                           "downloading the same URL and copy "
+                                           "their file instead."));
+  parser.addOption(dedupeOpt);
+
+  QCommandLineOption prefetchOpt(QStringList{"prefetch"},
+                                 QObject::tr("Number of queued downloads to "
+                                             "probe ahead of time. Small files "
+                                             "are downloaded entirely while "
+                                             "probing. (defaults to 4)"),
+                                 QObject::tr("num"));
+  parser.addOption(prefetchOpt);
+
+  QCommandLineOption updateOpt(QStringList{"update"},
+                               QObject::tr("Skip files that have not changed "
+                                           "since they were last downloaded."));
+  parser.addOption(updateOpt);
+
+  QCommandLineOption metadataCacheOpt(QStringList{"metadata-cache"},
+                                      QObject::tr("Cache resolved URLs, sizes "
+                                                  "and capabilities on disk and "
+                                                  "use them instead of probing "
+                                                  "for the given amount of "
+                                                  "seconds."),
+                                      QObject::tr("secs"));
+  parser.addOption(metadataCacheOpt);
+
   QCommandLineOption confirmOpt(QStringList{"confirm"},
                                 QObject::tr("Will ask to confirm to download on "
                                             "redirections or whether to truncate"
@@ -143,21 +272,54 @@ int main(int argc, char **argv) {
                                   QObject::tr("fmt"));
   parser.addOption(genChksumOpt);
 
+  QCommandLineOption daemonOpt(QStringList{"daemon"},
+                               QObject::tr("Keep running and accept downloads "
+                                           "from --submit or other clients of "
+                                           "the socket. URLs are optional."));
+  parser.addOption(daemonOpt);
+
+  QCommandLineOption submitOpt(QStringList{"submit"},
+                               QObject::tr("Hand the URLs to a running daemon "
+                                           "and print its events until they "
+                                           "are done."));
+  parser.addOption(submitOpt);
+
+  QCommandLineOption socketOpt(QStringList{"socket"},
+                               QObject::tr("Name of the local socket used by "
+                                           "--daemon and --submit. (defaults "
+                                           "to efdl)"),
+                               QObject::tr("name"));
+  parser.addOption(socketOpt);
+
   // Process CLI arguments.
   parser.process(app);
   QStringList args = parser.positionalArguments();
-  args.append(pipeIn.split('\n', QString::SkipEmptyParts));
-  if (args.size() < 1) {
+  bool daemon{parser.isSet(daemonOpt)};
+  if (args.size() < 1 && !daemon && !stdinPipe) {
     parser.showHelp(-1);
   }
 
-  int conns{1}, chunks{-1}, chunkSize{-1};
+  if (daemon && parser.isSet(submitOpt)) {
+    qCritical() << "ERROR --daemon and --submit cannot be used at the same time!";
+    return -1;
+  }
+
+  QString socketName{Daemon::defaultName()};
+  if (parser.isSet(socketOpt)) {
+    socketName = parser.value(socketOpt);
+  }
+
+  int conns{1};
+  qint64 chunks{-1}, chunkSize{-1}, resumeCheck{0};
   bool ok{false}, confirm{parser.isSet(confirmOpt)},
     verbose{parser.isSet(verboseOpt)},
     dryRun{parser.isSet(dryRunOpt)},
     resume{parser.isSet(resumeOpt)},
     connProg{parser.isSet(connProgOpt)},
-    showHeaders{parser.isSet(showHeadersOpt)};
+    showHeaders{parser.isSet(showHeadersOpt)},
+    prealloc{!parser.isSet(noPreallocOpt)},
+    dropCache{parser.isSet(dropCacheOpt)},
+    memoryMap{parser.isSet(mmapOpt)};
   QString dir, httpUser, httpPass;
   bool chksum{false};
   QCryptographicHash::Algorithm hashAlg{QCryptographicHash::Sha3_512};
@@ -165,6 +327,14 @@ int main(int argc, char **argv) {
 
   if (showHeaders) verbose = true;
 
+  // URLs from STDIN are read as they are needed, unless all of them have
+  // to be known up front or confirmations need STDIN.
+  bool streamInput{stdinPipe && !confirm && !parser.isSet(verifyOpt) &&
+      !parser.isSet(submitOpt)};
+  if (stdinPipe && !streamInput) {
+    args.append(input.readAll().split('\n', QString::SkipEmptyParts));
+  }
+
   if (parser.isSet(outputOpt)) {
     dir = parser.value(outputOpt);
     if (!QDir().exists(dir)) {
@@ -173,6 +343,32 @@ int main(int argc, char **argv) {
     }
   }
 
+  QString outputFile;
+  bool toStdout{false};
+  if (parser.isSet(outputFileOpt)) {
+    outputFile = parser.value(outputFileOpt);
+    toStdout = (outputFile == "-");
+    if (args.size() > 1 || streamInput || daemon) {
+      qCritical() << "ERROR -O can only be used with a single URL!";
+      return -1;
+    }
+  }
+
+  // Data written to STDOUT cannot be resumed, mapped, read back or
+  // prompted about.
+  if (toStdout) {
+    const QList<QCommandLineOption> conflicts{
+      resumeOpt, mmapOpt, verifyOpt, genChksumOpt, dedupeOpt, cacheDirOpt,
+      updateOpt, confirmOpt};
+    foreach (const auto &opt, conflicts) {
+      if (parser.isSet(opt)) {
+        qCritical() << "ERROR -O - cannot be used with"
+                    << qPrintable("--" + opt.names().last());
+        return -1;
+      }
+    }
+  }
+
   if (parser.isSet(connsOpt)) {
     conns = parser.value(connsOpt).toInt(&ok);
     if (!ok || conns <= 0) {
@@ -182,7 +378,7 @@ int main(int argc, char **argv) {
   }
 
   if (parser.isSet(chunksOpt)) {
-    chunks = parser.value(chunksOpt).toInt(&ok);
+    chunks = parser.value(chunksOpt).toLongLong(&ok);
     if (!ok || chunks <= 0) {
       qCritical() << "ERROR Number of chunks must be a positive number!";
       return -1;
@@ -190,13 +386,118 @@ int main(int argc, char **argv) {
   }
 
   if (parser.isSet(chunkSizeOpt)) {
-    chunkSize = parser.value(chunkSizeOpt).toInt(&ok);
+    chunkSize = parser.value(chunkSizeOpt).toLongLong(&ok);
     if (!ok || chunkSize <= 0) {
       qCritical() << "ERROR Chunk size must be a positive number!";
       return -1;
     }
   }
 
+  if (parser.isSet(resumeCheckOpt)) {
+    resumeCheck = parser.value(resumeCheckOpt).toLongLong(&ok);
+    if (!ok || resumeCheck <= 0) {
+      qCritical() << "ERROR Resume check size must be a positive number!";
+      return -1;
+    }
+  }
+
+  qint64 writeCoalesce{-1};
+  if (parser.isSet(writeCoalesceOpt)) {
+    writeCoalesce = parser.value(writeCoalesceOpt).toLongLong(&ok);
+    if (!ok || writeCoalesce < 0) {
+      qCritical() << "ERROR Write coalesce size must be zero or a positive number!";
+      return -1;
+    }
+  }
+
+  qint64 syncEvery{0};
+  if (parser.isSet(syncEveryOpt)) {
+    syncEvery = parser.value(syncEveryOpt).toLongLong(&ok);
+    if (!ok || syncEvery <= 0) {
+      qCritical() << "ERROR Sync size must be a positive number!";
+      return -1;
+    }
+  }
+
+  int syncInterval{0};
+  if (parser.isSet(syncIntervalOpt)) {
+    syncInterval = parser.value(syncIntervalOpt).toInt(&ok);
+    if (!ok || syncInterval <= 0) {
+      qCritical() << "ERROR Sync interval must be a positive number!";
+      return -1;
+    }
+  }
+
+  MetadataCache metadataCache;
+  bool useMetadataCache{parser.isSet(metadataCacheOpt)};
+  if (useMetadataCache) {
+    qint64 ttl{parser.value(metadataCacheOpt).toLongLong(&ok)};
+    if (!ok || ttl <= 0) {
+      qCritical() << "ERROR Metadata cache time must be a positive number!";
+      return -1;
+    }
+    metadataCache.setTTL(ttl);
+    metadataCache.setPath(MetadataCache::defaultPath());
+    metadataCache.load();
+  }
+
+  DownloadCache downloadCache;
+  bool useCache{parser.isSet(cacheDirOpt)};
+  if (useCache) {
+    QString cacheDir{parser.value(cacheDirOpt)};
+    if (!QDir().mkpath(cacheDir)) {
+      qCritical() << "ERROR Could not create cache directory:" << cacheDir;
+      return -1;
+    }
+    downloadCache.setDir(cacheDir);
+  }
+  if (parser.isSet(cacheSizeOpt)) {
+    qint64 size{parser.value(cacheSizeOpt).toLongLong(&ok)};
+    if (!ok || size <= 0) {
+      qCritical() << "ERROR Cache size must be a positive number!";
+      return -1;
+    }
+    downloadCache.setMaxSize(size);
+  }
+  downloadCache.setAllowLinks(parser.isSet(cacheLinksOpt));
+
+  bool dedupe{parser.isSet(dedupeOpt)};
+
+  int prefetch{-1};
+  if (parser.isSet(prefetchOpt)) {
+    prefetch = parser.value(prefetchOpt).toInt(&ok);
+    if (!ok || prefetch < 0) {
+      qCritical() << "ERROR Prefetch must be zero or a positive number!";
+      return -1;
+    }
+  }
+
+  ValidatorStore validatorStore;
+  bool update{parser.isSet(updateOpt)};
+  if (update) {
+    validatorStore.setPath(ValidatorStore::defaultPath());
+    validatorStore.load();
+  }
+
+  MemoryBudget memoryBudget;
+  if (parser.isSet(maxMemoryOpt)) {
+    qint64 limit{parser.value(maxMemoryOpt).toLongLong(&ok)};
+    if (!ok || limit <= 0) {
+      qCritical() << "ERROR Maximum memory must be a positive number!";
+      return -1;
+    }
+    memoryBudget.setLimit(limit);
+  }
+
+  WriteBackend::Type writeBackend{WriteBackend::Type::Auto};
+  if (parser.isSet(writeBackendOpt)) {
+    QString name{parser.value(writeBackendOpt)};
+    if (!WriteBackend::stringToType(name, writeBackend)) {
+      qCritical() << "ERROR Invalid write backend:" << qPrintable(name);
+      return -1;
+    }
+  }
+
   if (chunks != -1 && chunkSize != -1) {
     qCritical() << "ERROR --chunks and --chunk-size cannot be used at the same time!";
     return -1;
@@ -244,24 +545,51 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (daemon && confirm) {
+    qCritical() << "ERROR --confirm cannot be used with --daemon!";
+    return -1;
+  }
+
+  // The daemon does all the work so the other options are its business.
+  if (parser.isSet(submitOpt)) {
+    DaemonClient client{socketName, args, QDir(dir).absolutePath()};
+    QObject::connect(&client, &DaemonClient::finished,
+                     &app, &QCoreApplication::exit);
+    QTimer::singleShot(0, &client, SLOT(start()));
+    return app.exec();
+  }
+
+  // Shared by all downloads so connections to the same hosts are
+  // reused. Must outlive the downloads.
+  QNetworkAccessManager netmgr;
+
   DownloadManager manager{dryRun, connProg};
   manager.setVerifcations(verifyList);
+  manager.setDropCache(dropCache);
+  manager.setMemoryBudget(&memoryBudget);
+  manager.setKeepGoing(daemon);
+  manager.setProgressOnStderr(toStdout);
+  if (prefetch != -1) {
+    manager.setPrefetch(prefetch);
+  }
   if (chksum) {
     manager.createChecksum(hashAlg);
   }
 
+  // Creates downloaders for the URLs given here and for the ones
+  // submitted to the daemon.
   const QStringList schemes{"http", "https"};
-  foreach (const QString &arg, args) {
+  auto create = [&](const QString &arg, QString &error) -> Downloader* {
     QUrl url{arg.trimmed(), QUrl::StrictMode};
     if (!url.isValid()) {
-      qCritical() << "ERROR Invalid URL:" << arg;
-      return -1;
+      error = "ERROR Invalid URL: " + arg;
+      return nullptr;
     }
 
     if (!schemes.contains(url.scheme().toLower())) {
-      qCritical() << "ERROR Invalid scheme:" << qPrintable(arg);
-      qCritical() << "Valid ones are:" << qPrintable(schemes.join(" "));
-      return -1;
+      error = "ERROR Invalid scheme: " + arg + "\nValid ones are: " +
+        schemes.join(" ");
+      return nullptr;
     }
 
     auto *dl = new Downloader{url};
@@ -271,20 +599,113 @@ int main(int argc, char **argv) {
     dl->setChunkSize(chunkSize);
     dl->setConfirm(confirm);
     dl->setResume(resume);
+    dl->setResumeCheck(resumeCheck);
+    dl->setPreallocate(prealloc);
+    dl->setWriteBackend(writeBackend);
+    dl->setDropCache(dropCache);
+    dl->setMemoryMap(memoryMap);
+    if (writeCoalesce != -1) {
+      dl->setWriteCoalesce(writeCoalesce);
+    }
+    dl->setSyncPolicy(syncEvery, syncInterval);
+    dl->setMemoryBudget(&memoryBudget);
+    if (useMetadataCache) {
+      dl->setMetadataCache(&metadataCache);
+    }
+    if (update) {
+      dl->setValidatorStore(&validatorStore);
+    }
+    if (useCache) {
+      dl->setDownloadCache(&downloadCache);
+    }
+    dl->setDedupe(dedupe);
     dl->setVerbose(verbose);
     dl->setDryRun(dryRun);
     dl->setShowHeaders(showHeaders);
     dl->setHttpCredentials(httpUser, httpPass);
+    dl->setNetworkAccessManager(&netmgr);
+    if (toStdout) {
+      dl->setOutputSink(new PipeSink{fileno(stdout), "STDOUT"});
+      if (memoryBudget.getLimit() != -1) {
+        dl->setStreamWindow(memoryBudget.getLimit());
+      }
+    }
+    else if (!outputFile.isEmpty()) {
+      dl->setOutputFile(outputFile);
+    }
+    return dl;
+  };
 
+  foreach (const QString &arg, args) {
+    QString error;
+    auto *dl = create(arg, error);
+    if (!dl) {
+      qCritical() << qPrintable(error);
+      return -1;
+    }
     manager.add(dl);
   }
 
+  // Invalid URLs from STDIN are skipped since the ones before them might
+  // already be downloading.
+  bool badInput{false};
+  if (streamInput) {
+    // Lines are read on a thread of their own so that waiting for more
+    // does not hold up the downloads. It is not deleted since it might
+    // still be blocked reading STDIN when the application exits.
+    auto *reader = new LineReader{stdin};
+    manager.setSource([&, reader]() -> Downloader* {
+      for (;;) {
+        QString line{reader->takeLine()};
+        if (line.isNull()) {
+          return nullptr;
+        }
+
+        QString error;
+        auto *dl = create(line, error);
+        if (dl) {
+          return dl;
+        }
+        qCritical() << qPrintable(error);
+        badInput = true;
+      }
+    });
+    QObject::connect(reader, &LineReader::readyRead,
+                     &manager, &DownloadManager::sourceReady);
+    QObject::connect(reader, &QThread::finished,
+                     &manager, &DownloadManager::sourceEnded);
+    reader->start();
+  }
+
   Util::registerCustomTypes();
 
-  // Begin downloads in event loop.
-  QObject::connect(&manager, &DownloadManager::finished,
-                   &app, &QCoreApplication::quit);
+  Daemon server{&manager, create};
+  if (daemon) {
+    if (!server.listen(socketName)) {
+      qCritical() << "ERROR Could not listen on socket:"
+                  << qPrintable(socketName);
+      return -1;
+    }
+    qDebug() << "Listening on" << qPrintable(server.getPath());
+  }
+  else {
+    // Begin downloads in event loop.
+    QObject::connect(&manager, &DownloadManager::finished,
+                     &app, &QCoreApplication::quit);
+  }
   QTimer::singleShot(0, &manager, SLOT(start()));
 
-  return app.exec();
+  int ret{app.exec()};
+  if (badInput && ret == 0) {
+    ret = -1;
+  }
+  if (useMetadataCache && !metadataCache.save()) {
+    qWarning() << "WARN Could not save metadata cache:"
+               << qPrintable(metadataCache.getPath());
+  }
+  if (update && !validatorStore.save()) {
+    qWarning() << "WARN Could not save validators:"
+               << qPrintable(validatorStore.getPath());
+  }
+  return ret;
 }
@@ -0,0 +1,119 @@
+#include <QFile>
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "TestUtil.h"
+#include "TestServer.h"
+#include "CommitThread.h"
+
+USE_NAMESPACE
+
+Q_DECLARE_METATYPE(EFDL_NAMESPACE::WriteBackend::Type)
+
+class CommitThreadTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void coalesces_data() {
+    QTest::addColumn<qint64>("coalesceSize");
+    QTest::addColumn<int>("syscalls");
+    QTest::newRow("disabled") << qint64(0) << 256;
+    QTest::newRow("1 MB") << qint64(1048576) << 16;
+
+    // At most 64 chunks are written together.
+    QTest::newRow("4 MB") << qint64(4194304) << 4;
+    QTest::newRow("16 MB") << qint64(16777216) << 4;
+  }
+
+  // Chunks queued at once are sorted and adjacent ones are written
+  // with one system call.
+  void coalesces() {
+    QFETCH(qint64, coalesceSize);
+    QFETCH(int, syscalls);
+
+    QTemporaryDir dir;
+    QString path{dir.path() + "/out"};
+    auto *file = new QFile{path};
+    QVERIFY(file->open(QIODevice::ReadWrite));
+
+    const qint64 chunkSize{65536}, size{16777216};
+    auto chunks = TestUtil::makeChunks(size, chunkSize);
+    CommitThread thread;
+    thread.setFile(file);
+    thread.setBackendType(WriteBackend::Type::Pwrite);
+    thread.setCoalesceSize(coalesceSize);
+    for (int i = 0; i < chunks.size(); i++) {
+      qint64 pos{chunks[i].first};
+      thread.enqueueChunk(pos,
+                          new QByteArray(TestServer::synthetic(pos, chunkSize)),
+                          i == chunks.size() - 1);
+    }
+    thread.start();
+    QVERIFY(thread.wait(60000));
+    QVERIFY(!thread.hasError());
+
+#ifdef Q_OS_LINUX
+    // Elsewhere a vectored write is one pwrite() per chunk.
+    QCOMPARE(int(thread.getSyscalls()), syscalls);
+#else
+    Q_UNUSED(syscalls);
+#endif
+
+    QFile out{path};
+    QVERIFY(out.open(QIODevice::ReadOnly));
+    QVERIFY(out.readAll() == TestServer::synthetic(0, size));
+  }
+
+  void coalescing_data() {
+    QTest::addColumn<WriteBackend::Type>("type");
+    QTest::addColumn<qint64>("chunkSize");
+    QTest::addColumn<qint64>("coalesceSize");
+    QList<qint64> chunkSizes{16384, 65536, 262144},
+      coalesceSizes{0, 1048576, 4194304};
+    foreach (qint64 chunkSize, chunkSizes) {
+      foreach (qint64 coalesceSize, coalesceSizes) {
+        QString name{QString("%1 KB chunks, %2 KB")
+            .arg(chunkSize / 1024).arg(coalesceSize / 1024)};
+        QTest::newRow(qPrintable("pwrite " + name))
+          << WriteBackend::Type::Pwrite << chunkSize << coalesceSize;
+        QTest::newRow(qPrintable("io_uring " + name))
+          << WriteBackend::Type::IoUring << chunkSize << coalesceSize;
+      }
+    }
+  }
+
+  // MB/s and system calls per GB of committing 1 GB of small chunks
+  // with and without coalescing.
+  void coalescing() {
+    if (!TestUtil::isBenchmark()) {
+      QSKIP("Set EFDL_BENCH to run benchmarks");
+    }
+    QFETCH(WriteBackend::Type, type);
+    QFETCH(qint64, chunkSize);
+    QFETCH(qint64, coalesceSize);
+
+    const qint64 size{1073741824};
+    QTemporaryDir dir{TestUtil::benchDir()};
+    QByteArray pattern{TestServer::synthetic(0, chunkSize)};
+    CommitThread thread;
+    thread.setBackendType(type);
+    thread.setCoalesceSize(coalesceSize);
+    QVERIFY(TestUtil::commitAll(thread, dir.path() + "/out",
+                                TestUtil::makeChunks(size, chunkSize),
+                                [&pattern](qint64, qint64 len) {
+                                  return pattern.left(len);
+                                }));
+    if (type == WriteBackend::Type::IoUring &&
+        thread.getBackendName() != "io_uring") {
+      QSKIP("io_uring is not available");
+    }
+
+    qint64 msecs{qMax(thread.getElapsed(), qint64(1))};
+    qDebug("%.0f MB/s, %.0f syscalls/GB",
+           double(size) / 1048576 * 1000 / msecs,
+           double(thread.getSyscalls()) * 1073741824 / size);
+  }
+};
+
+QTEST_MAIN(CommitThreadTest)
+#include "CommitThreadTest.moc"
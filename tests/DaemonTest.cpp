@@ -0,0 +1,158 @@
+#include <QDir>
+#include <QFile>
+#include <QtTest>
+#include <QProcess>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QCoreApplication>
+
+#include "TestUtil.h"
+#include "TestServer.h"
+
+USE_NAMESPACE
+
+namespace {
+  const qint64 FILE_SIZE{4096};
+  const int FILES{200};
+
+  QString filePath(int i) {
+    return QString("/file-%1").arg(i);
+  }
+
+  bool hasSynthetic(const QString &path) {
+    QFile file{path};
+    return file.open(QIODevice::ReadOnly) &&
+      file.readAll() == TestServer::synthetic(0, FILE_SIZE);
+  }
+
+  // Starts a daemon on the socket and waits until it accepts clients.
+  bool startDaemon(QProcess &proc, const QString &name) {
+    proc.setProcessChannelMode(QProcess::ForwardedChannels);
+    proc.start(EFDL_BINARY, QStringList() << "--daemon" << "--socket" << name);
+    if (!proc.waitForStarted()) {
+      return false;
+    }
+    proc.closeWriteChannel();
+    for (int i = 0; i < 100; i++) {
+      QLocalSocket socket;
+      socket.connectToServer(name);
+      if (socket.waitForConnected(100)) {
+        return true;
+      }
+      QTest::qWait(50);
+    }
+    return false;
+  }
+
+  // Submits a job per URL and returns how many of them finished, once
+  // all of them are done.
+  int runJobs(const QString &name, const QList<QUrl> &urls,
+              const QString &dir) {
+    QLocalSocket socket;
+    socket.connectToServer(name);
+    if (!socket.waitForConnected(5000)) {
+      return -1;
+    }
+    foreach (const auto &url, urls) {
+      QJsonObject job;
+      job["url"] = url.toString();
+      job["output"] = dir;
+      socket.write(QJsonDocument{job}.toJson(QJsonDocument::Compact) + '\n');
+    }
+
+    int done{0}, finished{0};
+    while (done < urls.size() && socket.waitForReadyRead(60000)) {
+      while (socket.canReadLine()) {
+        QJsonObject event{QJsonDocument::fromJson(socket.readLine()).object()};
+        QString type{event["event"].toString()};
+        if (type == "finished") {
+          finished++;
+        }
+        else if (type != "failed" && type != "error") {
+          continue;
+        }
+        done++;
+      }
+    }
+    return finished;
+  }
+}
+
+class DaemonTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void initTestCase() {
+    for (int i = 0; i < FILES; i++) {
+      server.addSynthetic(filePath(i), FILE_SIZE);
+    }
+    QVERIFY(server.listen());
+    name = QString("efdl-test-%1").arg(QCoreApplication::applicationPid());
+    QVERIFY(startDaemon(daemon, name));
+  }
+
+  void cleanupTestCase() {
+    daemon.kill();
+    daemon.waitForFinished();
+  }
+
+  void runsSubmittedJobs() {
+    QTemporaryDir dir;
+    QList<QUrl> urls;
+    for (int i = 0; i < 3; i++) {
+      urls << server.getUrl(filePath(i));
+    }
+    QCOMPARE(runJobs(name, urls, dir.path()), urls.size());
+    for (int i = 0; i < 3; i++) {
+      QVERIFY(hasSynthetic(dir.path() + filePath(i)));
+    }
+  }
+
+  // Time per small file of starting a process for each of them compared
+  // to submitting them to the daemon.
+  void submitOverhead() {
+    if (!TestUtil::isBenchmark()) {
+      QSKIP("Set EFDL_BENCH to run benchmarks");
+    }
+
+    QTemporaryDir processDir, daemonDir;
+    QList<QUrl> urls;
+    for (int i = 0; i < FILES; i++) {
+      urls << server.getUrl(filePath(i));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    foreach (const auto &url, urls) {
+      QProcess proc;
+      proc.start(EFDL_BINARY, QStringList() << "-o" << processDir.path()
+                 << url.toString());
+
+      // Otherwise it waits for more URLs on STDIN.
+      proc.closeWriteChannel();
+      QVERIFY(proc.waitForFinished(60000));
+      QCOMPARE(proc.exitCode(), 0);
+    }
+    qint64 processes{timer.elapsed()};
+
+    timer.restart();
+    QCOMPARE(runJobs(name, urls, daemonDir.path()), FILES);
+    qint64 jobs{timer.elapsed()};
+
+    QVERIFY(hasSynthetic(processDir.path() + filePath(FILES - 1)));
+    QVERIFY(hasSynthetic(daemonDir.path() + filePath(FILES - 1)));
+    qDebug("%d files of %lld bytes: %.1f ms per process, %.1f ms per job",
+           FILES, FILE_SIZE, double(processes) / FILES, double(jobs) / FILES);
+  }
+
+private:
+  TestServer server;
+  QProcess daemon;
+  QString name;
+};
+
+QTEST_MAIN(DaemonTest)
+#include "DaemonTest.moc"
@@ -0,0 +1,84 @@
+#include <QDir>
+#include <QFile>
+#include <QtTest>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include "TestServer.h"
+
+USE_NAMESPACE
+
+namespace {
+  const qint64 SIZE{8 * 1048576};
+
+  // Starts efdl downloading the URL into the directory with --dedupe.
+  // STDIN is closed since efdl reads more URLs from a pipe until then.
+  void startEfdl(QProcess &proc, const QUrl &url, const QString &dir) {
+    proc.setProcessChannelMode(QProcess::ForwardedChannels);
+    proc.start(EFDL_BINARY, QStringList() << "--dedupe" << "-c" << "2"
+               << "-o" << dir << url.toString());
+    proc.closeWriteChannel();
+  }
+
+  bool hasSynthetic(const QString &path) {
+    QFile file{path};
+    return file.open(QIODevice::ReadOnly) &&
+      file.readAll() == TestServer::synthetic(0, SIZE);
+  }
+}
+
+class DedupeTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void initTestCase() {
+    // The probe takes a second and the whole file about four with two
+    // connections, which leaves time to start the other process.
+    server.addSynthetic("/shared", SIZE);
+    server.addSynthetic("/killed", SIZE);
+    server.setRate(1048576);
+    QVERIFY(server.listen());
+  }
+
+  // A second process waits for the first one and copies its file, so
+  // the file is only downloaded once besides the probe of the second.
+  void sharesDownload() {
+    QTemporaryDir first, second;
+    QProcess owner, waiter;
+    startEfdl(owner, server.getUrl("/shared"), first.path());
+    QVERIFY(owner.waitForStarted());
+    QTest::qWait(1500);
+    startEfdl(waiter, server.getUrl("/shared"), second.path());
+
+    QVERIFY(owner.waitForFinished(60000));
+    QVERIFY(waiter.waitForFinished(60000));
+    QCOMPARE(owner.exitCode(), 0);
+    QCOMPARE(waiter.exitCode(), 0);
+    QVERIFY(hasSynthetic(first.path() + "/shared"));
+    QVERIFY(hasSynthetic(second.path() + "/shared"));
+    QVERIFY(server.getBytesServed() < SIZE + 2 * 1048576);
+  }
+
+  // A waiting process downloads the file itself when the owner dies.
+  void takesOverFromKilledOwner() {
+    QTemporaryDir first, second;
+    QProcess owner, waiter;
+    startEfdl(owner, server.getUrl("/killed"), first.path());
+    QVERIFY(owner.waitForStarted());
+    QTest::qWait(1500);
+    startEfdl(waiter, server.getUrl("/killed"), second.path());
+    QTest::qWait(2000);
+    owner.kill();
+    QVERIFY(owner.waitForFinished(10000));
+
+    QVERIFY(waiter.waitForFinished(60000));
+    QCOMPARE(waiter.exitCode(), 0);
+    QVERIFY(hasSynthetic(second.path() + "/killed"));
+  }
+
+private:
+  TestServer server;
+};
+
+QTEST_MAIN(DedupeTest)
+#include "DedupeTest.moc"
@@ -0,0 +1,82 @@
+#include <QDir>
+#include <QFile>
+#include <QtTest>
+#include <QFileInfo>
+#include <QTemporaryDir>
+
+#include "DownloadCache.h"
+
+USE_NAMESPACE
+
+namespace {
+  const QUrl URL{"http://example.com/file"};
+  const QByteArray ETAG{"\"a\""};
+
+  bool writeFile(const QString &path, const QByteArray &data) {
+    QFile file{path};
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+  }
+
+  QByteArray readFile(const QString &path) {
+    QFile file{path};
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+  }
+}
+
+class DownloadCacheTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  // Fetched copies can be changed without changing the cache.
+  void fetchesWritableCopy() {
+    QTemporaryDir dir;
+    DownloadCache cache;
+    cache.setDir(dir.path() + "/cache");
+    QVERIFY(QDir().mkpath(cache.getDir()));
+
+    QString src{dir.path() + "/src"}, dst{dir.path() + "/dst"};
+    QVERIFY(writeFile(src, "cached data"));
+    QVERIFY(cache.store(URL, ETAG, src));
+    QVERIFY(!cache.fetch(URL, "\"b\"", dst));
+    QVERIFY(cache.fetch(URL, ETAG, dst));
+    QCOMPARE(readFile(dst), QByteArray("cached data"));
+
+    QVERIFY(QFileInfo(dst).isWritable());
+    QVERIFY(writeFile(dst, "changed"));
+    QString again{dir.path() + "/again"};
+    QVERIFY(cache.fetch(URL, ETAG, again));
+    QCOMPARE(readFile(again), QByteArray("cached data"));
+
+    // No temporary copies are left behind.
+    QDir objects{cache.getDir() + "/objects"};
+    QCOMPARE(objects.entryList(QDir::Files).size(), 1);
+  }
+
+  // Evicting an object leaves files linked to it as they were.
+  void evictsWithoutChangingLinks() {
+    QTemporaryDir dir;
+    DownloadCache cache;
+    cache.setDir(dir.path() + "/cache");
+    cache.setAllowLinks(true);
+    QVERIFY(QDir().mkpath(cache.getDir()));
+
+    QString first{dir.path() + "/first"}, second{dir.path() + "/second"},
+      linked{dir.path() + "/linked"};
+    QVERIFY(writeFile(first, QByteArray(1000, 'a')));
+    QVERIFY(writeFile(second, QByteArray(1000, 'b')));
+    QVERIFY(cache.store(URL, ETAG, first));
+    QVERIFY(cache.fetch(URL, ETAG, linked));
+    auto perms = QFile::permissions(linked);
+
+    // The first object is the least recently used one.
+    QTest::qSleep(10);
+    cache.setMaxSize(1500);
+    QVERIFY(cache.store(QUrl{"http://example.com/second"}, ETAG, second));
+    QVERIFY(!cache.fetch(URL, ETAG, dir.path() + "/gone"));
+    QCOMPARE(QFile::permissions(linked), perms);
+    QCOMPARE(readFile(linked), QByteArray(1000, 'a'));
+  }
+};
+
+QTEST_MAIN(DownloadCacheTest)
+#include "DownloadCacheTest.moc"
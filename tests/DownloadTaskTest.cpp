@@ -0,0 +1,112 @@
+#include <QUrl>
+#include <QTimer>
+#include <QtTest>
+#include <QEventLoop>
+
+#include "Util.h"
+#include "TestServer.h"
+#include "DownloadTask.h"
+
+USE_NAMESPACE
+
+namespace {
+  const qint64 TB{1099511627776};
+
+  // Compares without making a copy of the expected data.
+  bool isSynthetic(qint64 pos, const QByteArray &data) {
+    const char *ptr = data.constData();
+    for (qint64 i = 0; i < data.size(); i++) {
+      if (ptr[i] != TestServer::byteAt(pos + i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+class DownloadTaskTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void initTestCase() {
+    Util::registerCustomTypes();
+    server.addSynthetic("/huge", 4 * TB);
+    server.addSynthetic("/cut", 1048576);
+    server.setCutOff("/cut", 500000);
+    QVERIFY(server.listen());
+  }
+
+  // Ranges larger than a QByteArray can hold are passed on in segments
+  // of MAX_SEGMENT, at 64-bit positions, followed by the rest.
+  void handsOffSegments() {
+    const qint64 size{4 * TB}, len{DownloadTask::MAX_SEGMENT + 1048583};
+    QUrl url{server.getUrl("/huge")};
+    Range range{size - len, size - 1};
+    DownloadTask task{url, range, 5000000000};
+
+    QList<qint64> segments;
+    qint64 finalPos{-1}, finalSize{-1}, num{0};
+    bool matches{true}, failed{false};
+    QEventLoop loop;
+    connect(&task, &DownloadTask::segment, &loop,
+            [&](qint64 n, qint64 pos, QByteArray *data) {
+              num = n;
+              segments << pos << data->size();
+              matches = matches && isSynthetic(pos, *data);
+              delete data;
+            });
+    connect(&task, &DownloadTask::finished, &loop,
+            [&](qint64, Range, qint64 pos, QByteArray *data) {
+              finalPos = pos;
+              finalSize = data->size();
+              matches = matches && isSynthetic(pos, *data);
+              delete data;
+              loop.quit();
+            });
+    connect(&task, &DownloadTask::failed, &loop,
+            [&](qint64, Range, int, QNetworkReply::NetworkError) {
+              failed = true;
+              loop.quit();
+            });
+    QTimer::singleShot(300000, &loop, SLOT(quit()));
+    task.start();
+    loop.exec();
+    task.wait();
+
+    QVERIFY(!failed);
+    QCOMPARE(num, qint64(5000000000));
+    QCOMPARE(segments, QList<qint64>() << range.first
+             << DownloadTask::MAX_SEGMENT);
+    QCOMPARE(finalPos, range.first + DownloadTask::MAX_SEGMENT);
+    QCOMPARE(finalSize, len - DownloadTask::MAX_SEGMENT);
+    QVERIFY(matches);
+  }
+
+  // A response that breaks off is not passed on as the chunk.
+  void failsShortTransfer() {
+    QUrl url{server.getUrl("/cut")};
+    DownloadTask task{url, Range{0, 1048575}, 1};
+    int finished{0}, failed{0};
+    connect(&task, &DownloadTask::segment,
+            [](qint64, qint64, QByteArray *data) { delete data; });
+    connect(&task, &DownloadTask::finished,
+            [&](qint64, Range, qint64, QByteArray *data) {
+              finished++;
+              delete data;
+            });
+    connect(&task, &DownloadTask::failed,
+            [&](qint64, Range, int, QNetworkReply::NetworkError) {
+              failed++;
+            });
+    task.start();
+    QVERIFY(task.wait(60000));
+    QCOMPARE(finished, 0);
+    QCOMPARE(failed, 1);
+  }
+
+private:
+  TestServer server;
+};
+
+QTEST_MAIN(DownloadTaskTest)
+#include "DownloadTaskTest.moc"
@@ -0,0 +1,313 @@
+#include <QDir>
+#include <QFile>
+#include <QTimer>
+#include <QFileInfo>
+#include <QtTest>
+#include <QEventLoop>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include "Util.h"
+#include "TestUtil.h"
+#include "TestServer.h"
+#include "OutputSink.h"
+#include "Downloader.h"
+#include "ResumeJournal.h"
+#include "ValidatorStore.h"
+
+USE_NAMESPACE
+
+namespace {
+  const qint64 TB{1099511627776};
+
+  // Runs the download and returns whether it finished in time without
+  // it or any of its chunks failing.
+  bool run(Downloader &dl, int timeout = 60000) {
+    QEventLoop loop;
+    bool ok{false};
+    QObject::connect(&dl, &Downloader::finished, &loop, [&] {
+      ok = true;
+      loop.quit();
+    });
+    QObject::connect(&dl, &Downloader::failed, &loop, &QEventLoop::quit);
+    QObject::connect(&dl, &Downloader::chunkFailed, &loop, &QEventLoop::quit);
+    QTimer::singleShot(timeout, &loop, SLOT(quit()));
+    dl.start();
+    loop.exec();
+    return ok;
+  }
+
+  bool waitFor(QSignalSpy &spy, int count, int timeout = 60000) {
+    while (spy.count() < count) {
+      if (!spy.wait(timeout)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  QString chunksPath(qint64 chunks) {
+    return QString("/chunks-%1").arg(chunks);
+  }
+}
+
+class DownloaderTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void initTestCase() {
+    Util::registerCustomTypes();
+    server.addSynthetic("/file", 200 * 16384 + 123);
+    server.addSynthetic("/huge", 4 * TB);
+    server.setETag("/huge", "\"huge\"");
+    server.addSynthetic("/cut", 200 * 16384);
+    server.setCutOff("/cut", 100000);
+    server.addSynthetic("/stale", 64 * 16384);
+
+    // A chunk of a megabyte each.
+    for (qint64 chunks = 1000; chunks <= 10000000; chunks *= 10) {
+      server.addSynthetic(chunksPath(chunks), chunks * 1048576);
+    }
+    QVERIFY(server.listen());
+
+    noRanges.addSynthetic("/large", 64 * 1048576);
+    noRanges.setRanges(false);
+    QVERIFY(noRanges.listen());
+  }
+
+  void downloadsInChunks() {
+    const qint64 size{200 * 16384 + 123};
+    auto *sink = new MemorySink;
+    Downloader dl{server.getUrl("/file")};
+    dl.setOutputSink(sink);
+    dl.setChunkSize(16384);
+    dl.setConnections(4);
+    QSignalSpy info{&dl, SIGNAL(information(QString, qint64, qint64, int,
+                                            qint64))};
+    QVERIFY(run(dl));
+
+    // The probe is the first chunk.
+    QCOMPARE(info.count(), 1);
+    QCOMPARE(info.first().at(1).toLongLong(), size);
+    QCOMPARE(info.first().at(2).toLongLong(), qint64(201));
+    QVERIFY(sink->getData() == TestServer::synthetic(0, size));
+  }
+
+  // Output that cannot be finished fails the download.
+  void failsUnfinishedSink() {
+    auto *sink = new CallbackSink([](qint64, const QByteArray &) {
+        return true;
+      });
+    sink->setDone([](bool) { return false; });
+    Downloader dl{server.getUrl("/file")};
+    dl.setOutputSink(sink);
+    dl.setChunkSize(16384);
+    QSignalSpy failed{&dl, SIGNAL(failed(QString))};
+    QVERIFY(!run(dl));
+    QCOMPARE(failed.count(), 1);
+    QVERIFY(failed.first().first().toString()
+            .contains("Could not be finished by callback"));
+  }
+
+  // A current copy recorded in the store is only used when it is where
+  // the output would go.
+  void usesOnlyLocalCopyAtOutput() {
+    QTemporaryDir dir;
+    QString first{dir.path() + "/first"}, second{dir.path() + "/second"};
+    QVERIFY(QDir().mkpath(first) && QDir().mkpath(second));
+    ValidatorStore store;
+    store.setPath(dir.path() + "/validators.json");
+
+    QStringList local;
+    auto download = [&](const QString &outputDir) {
+      Downloader dl{server.getUrl("/file")};
+      dl.setOutputDir(outputDir);
+      dl.setValidatorStore(&store);
+      connect(&dl, &Downloader::completedLocally,
+              [&](const QString &path) { local << path; });
+      return run(dl);
+    };
+
+    QVERIFY(download(first));
+    QVERIFY(local.isEmpty());
+    QVERIFY(download(second));
+    QVERIFY(local.isEmpty());
+    QVERIFY(QFile::exists(second + "/file"));
+    QVERIFY(download(second));
+    QCOMPARE(local, QStringList() << QDir{second}.absoluteFilePath("file"));
+  }
+
+  // A chunk that breaks off fails the download, which is then not
+  // recorded as a current copy.
+  void failsTruncatedTransfer() {
+    QTemporaryDir dir;
+    ValidatorStore store;
+    store.setPath(dir.path() + "/validators.json");
+    Downloader dl{server.getUrl("/cut")};
+    dl.setOutputDir(dir.path());
+    dl.setChunkSize(16384);
+    dl.setValidatorStore(&store);
+    QVERIFY(!run(dl));
+    dl.stop();
+
+    ValidatorStore::Entry entry;
+    QVERIFY(!store.lookup(server.getUrl("/cut"), entry));
+  }
+
+  // A server ignoring the range of the probe has the response cut off
+  // instead of buffered, and the file is then sent once more.
+  void cutsProbeWithoutRanges() {
+    const qint64 size{64 * 1048576};
+    QTemporaryDir dir;
+    Downloader dl{noRanges.getUrl("/large")};
+    dl.setOutputDir(dir.path());
+    dl.setConnections(4);
+    QVERIFY(run(dl));
+    QCOMPARE(QFileInfo(dir.path() + "/large").size(), size);
+    QVERIFY(noRanges.getBytesServed() < size + size / 2);
+  }
+
+  // Metadata cached before the remote file changed makes the server
+  // send all of it instead of the ranges, so it is probed again.
+  void restartsOnStaleMetadata() {
+    const qint64 size{64 * 16384};
+    QTemporaryDir dir;
+    QUrl url{server.getUrl("/stale")};
+    MetadataCache cache;
+    cache.setTTL(3600);
+    ResourceInfo info;
+    info.url = url;
+    info.size = size;
+    info.etag = "\"old\"";
+    info.single = false;
+    info.resumable = true;
+    info.fetched = QDateTime::currentDateTime();
+    cache.insert(url, info);
+
+    Downloader dl{url};
+    dl.setOutputDir(dir.path());
+    dl.setChunkSize(16384);
+    dl.setConnections(4);
+    dl.setMetadataCache(&cache);
+    QVERIFY(run(dl));
+
+    QFile file{dir.path() + "/stale"};
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() == TestServer::synthetic(0, size));
+    QVERIFY(cache.lookup(url, info));
+    QVERIFY(info.etag != "\"old\"");
+  }
+
+  // Only the missing tail of a multi-terabyte file is downloaded and
+  // committed at its 64-bit position in the sparse file.
+  void resumesHugeFile() {
+    const qint64 size{4 * TB}, tail{3 * 1048576 + 17};
+    QTemporaryDir dir;
+    QString path{dir.path() + "/huge"};
+    {
+      QFile file{path};
+      if (!file.open(QIODevice::WriteOnly) || !file.resize(size)) {
+        QSKIP("File system does not support sparse files this large");
+      }
+    }
+    ResumeJournal journal;
+    journal.setPath(ResumeJournal::pathFor(path));
+    journal.setContentLength(size);
+    journal.setETag("\"huge\"");
+    journal.addRange(Range{0, size - tail});
+    QVERIFY(journal.save());
+
+    server.resetCounters();
+    Downloader dl{server.getUrl("/huge")};
+    dl.setOutputFile(path);
+    dl.setResume(true);
+    dl.setPreallocate(false);
+    dl.setChunkSize(1048576);
+    dl.setConnections(2);
+    QSignalSpy info{&dl, SIGNAL(information(QString, qint64, qint64, int,
+                                            qint64))};
+    QVERIFY(run(dl));
+
+    QCOMPARE(info.first().at(2).toLongLong(), qint64(4));
+    QCOMPARE(info.first().at(4).toLongLong(), size - tail);
+
+    // Besides the tail, only the byte of the probe.
+    QVERIFY(server.getBytesServed() <= tail + 1);
+    QVERIFY(!QFile::exists(journal.getPath()));
+
+    QFile file{path};
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.size(), size);
+    QVERIFY(file.seek(size - tail));
+    QVERIFY(file.read(tail) == TestServer::synthetic(size - tail, tail));
+  }
+
+  // More chunks than fit in 32 bits.
+  void countsChunksBeyond32Bits() {
+    QAtomicInt mismatches{0};
+    Downloader dl{server.getUrl("/huge")};
+    dl.setOutputSink(new CallbackSink([&](qint64 pos, const QByteArray &data) {
+          if (data != TestServer::synthetic(pos, data.size())) {
+            mismatches.ref();
+          }
+          return true;
+        }, true));
+    dl.setChunkSize(1024);
+    dl.setConnections(4);
+    QSignalSpy info{&dl, SIGNAL(information(QString, qint64, qint64, int,
+                                            qint64))};
+    QSignalSpy finished{&dl, SIGNAL(chunkFinished(qint64, Range))};
+    dl.start();
+    QVERIFY(waitFor(info, 1));
+    QCOMPARE(info.first().at(2).toLongLong(), qint64(4294967296));
+    QVERIFY(waitFor(finished, 16));
+    dl.stop();
+    QCOMPARE(mismatches.load(), 0);
+  }
+
+  void scaling_data() {
+    QTest::addColumn<qint64>("chunks");
+    for (qint64 chunks = 1000; chunks <= 10000000; chunks *= 10) {
+      QTest::newRow(qPrintable(QString::number(chunks))) << chunks;
+    }
+  }
+
+  // Time until the download is set up and until the first 64 chunks
+  // have finished, neither of which may depend on the amount of chunks.
+  void scaling() {
+    if (!TestUtil::isBenchmark()) {
+      QSKIP("Set EFDL_BENCH to run benchmarks");
+    }
+    QFETCH(qint64, chunks);
+
+    Downloader dl{server.getUrl(chunksPath(chunks))};
+    dl.setOutputSink(new CallbackSink([](qint64, const QByteArray &) {
+          return true;
+        }, true));
+    dl.setChunkSize(1048576);
+    dl.setConnections(8);
+    QSignalSpy info{&dl, SIGNAL(information(QString, qint64, qint64, int,
+                                            qint64))};
+    QSignalSpy finished{&dl, SIGNAL(chunkFinished(qint64, Range))};
+
+    QElapsedTimer timer;
+    timer.start();
+    dl.start();
+    QVERIFY(waitFor(info, 1));
+    qint64 setup{timer.elapsed()};
+    QCOMPARE(info.first().at(2).toLongLong(), chunks);
+    QVERIFY(waitFor(finished, 64));
+    qint64 first{timer.elapsed()};
+    dl.stop();
+
+    qDebug("%lld chunks: set up in %lld ms, 64 chunks in %lld ms",
+           chunks, setup, first);
+  }
+
+private:
+  TestServer server, noRanges;
+};
+
+QTEST_MAIN(DownloaderTest)
+#include "DownloaderTest.moc"
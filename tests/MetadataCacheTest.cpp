@@ -0,0 +1,89 @@
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "MetadataCache.h"
+
+USE_NAMESPACE
+
+namespace {
+  ResourceInfo makeInfo(const QByteArray &etag,
+                        const QByteArray &lastModified,
+                        bool resumable = true) {
+    ResourceInfo info;
+    info.url = QUrl{"http://example.com/file"};
+    info.size = 1234;
+    info.etag = etag;
+    info.lastModified = lastModified;
+    info.single = !resumable;
+    info.resumable = resumable;
+    info.fetched = QDateTime::currentDateTime();
+    return info;
+  }
+}
+
+class MetadataCacheTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void needsValidator_data() {
+    QTest::addColumn<QByteArray>("etag");
+    QTest::addColumn<QByteArray>("lastModified");
+    QTest::addColumn<bool>("kept");
+    QByteArray date{"Mon, 01 Jan 2024 00:00:00 GMT"};
+    QTest::newRow("none") << QByteArray() << QByteArray() << false;
+    QTest::newRow("weak etag") << QByteArray("W/\"a\"") << QByteArray()
+                               << false;
+    QTest::newRow("strong etag") << QByteArray("\"a\"") << QByteArray()
+                                 << true;
+    QTest::newRow("last modified") << QByteArray() << date << true;
+    QTest::newRow("weak etag and last modified") << QByteArray("W/\"a\"")
+                                                 << date << true;
+  }
+
+  // Metadata that the server cannot confirm with If-Range is not cached.
+  void needsValidator() {
+    QFETCH(QByteArray, etag);
+    QFETCH(QByteArray, lastModified);
+    QFETCH(bool, kept);
+
+    QTemporaryDir dir;
+    QUrl url{"http://example.com/file"};
+    MetadataCache cache;
+    cache.setPath(dir.path() + "/metadata.json");
+    cache.setTTL(3600);
+
+    // Replaces what was there before.
+    cache.insert(url, makeInfo("\"old\"", QByteArray()));
+    cache.insert(url, makeInfo(etag, lastModified));
+
+    ResourceInfo info;
+    QCOMPARE(cache.lookup(url, info), kept);
+    QVERIFY(cache.save());
+
+    MetadataCache loaded;
+    loaded.setPath(cache.getPath());
+    loaded.setTTL(3600);
+    loaded.load();
+    QCOMPARE(loaded.lookup(url, info), kept);
+    if (kept) {
+      QCOMPARE(info.size, qint64(1234));
+      QCOMPARE(info.etag, etag);
+      QCOMPARE(info.lastModified, lastModified);
+    }
+  }
+
+  // Without ranges there is nothing If-Range could confirm.
+  void needsRanges() {
+    QUrl url{"http://example.com/file"};
+    MetadataCache cache;
+    cache.setTTL(3600);
+    cache.insert(url, makeInfo("\"a\"", QByteArray()));
+    cache.insert(url, makeInfo("\"a\"", QByteArray(), false));
+
+    ResourceInfo info;
+    QVERIFY(!cache.lookup(url, info));
+  }
+};
+
+QTEST_MAIN(MetadataCacheTest)
+#include "MetadataCacheTest.moc"
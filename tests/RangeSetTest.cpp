@@ -0,0 +1,256 @@
+#include <QtTest>
+#include <QVector>
+#include <QDataStream>
+#include <QElapsedTimer>
+
+#include <algorithm>
+
+#include "TestUtil.h"
+#include "RangeSet.h"
+
+USE_NAMESPACE
+
+namespace {
+  typedef QList<Range> Ranges;
+
+  RangeSet makeSet(const Ranges &ranges) {
+    RangeSet set;
+    foreach (const auto &range, ranges) {
+      set.add(range);
+    }
+    return set;
+  }
+
+  qint64 sumOf(const Ranges &ranges) {
+    qint64 sum{0};
+    foreach (const auto &range, ranges) {
+      sum += range.second - range.first;
+    }
+    return sum;
+  }
+}
+
+Q_DECLARE_METATYPE(EFDL_NAMESPACE::Range)
+Q_DECLARE_METATYPE(Ranges)
+
+class RangeSetTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void add_data() {
+    QTest::addColumn<Ranges>("added");
+    QTest::addColumn<Ranges>("expected");
+    QTest::newRow("empty range") << (Ranges() << Range{5, 5}) << Ranges();
+    QTest::newRow("disjoint")
+      << (Ranges() << Range{20, 30} << Range{0, 10})
+      << (Ranges() << Range{0, 10} << Range{20, 30});
+    QTest::newRow("adjacent before")
+      << (Ranges() << Range{10, 20} << Range{0, 10})
+      << (Ranges() << Range{0, 20});
+    QTest::newRow("adjacent after")
+      << (Ranges() << Range{0, 10} << Range{10, 20})
+      << (Ranges() << Range{0, 20});
+    QTest::newRow("overlapping")
+      << (Ranges() << Range{0, 10} << Range{5, 15})
+      << (Ranges() << Range{0, 15});
+    QTest::newRow("contained")
+      << (Ranges() << Range{0, 10} << Range{2, 8})
+      << (Ranges() << Range{0, 10});
+    QTest::newRow("containing")
+      << (Ranges() << Range{2, 8} << Range{0, 10})
+      << (Ranges() << Range{0, 10});
+    QTest::newRow("spanning several")
+      << (Ranges() << Range{0, 2} << Range{4, 6} << Range{8, 10}
+          << Range{12, 14} << Range{1, 9})
+      << (Ranges() << Range{0, 10} << Range{12, 14});
+    QTest::newRow("filling a gap")
+      << (Ranges() << Range{0, 10} << Range{20, 30} << Range{10, 20})
+      << (Ranges() << Range{0, 30});
+    QTest::newRow("beyond 32 bits")
+      << (Ranges() << Range{4294967296, 8589934592}
+          << Range{8589934592, 8589934593})
+      << (Ranges() << Range{4294967296, 8589934593});
+  }
+
+  void add() {
+    QFETCH(Ranges, added);
+    QFETCH(Ranges, expected);
+    auto set = makeSet(added);
+    QCOMPARE(set.getRanges(), expected);
+    QCOMPARE(set.getCount(), expected.size());
+    QCOMPARE(set.getBytes(), sumOf(expected));
+    QCOMPARE(set.isEmpty(), expected.isEmpty());
+  }
+
+  void remove_data() {
+    QTest::addColumn<Ranges>("added");
+    QTest::addColumn<Range>("removed");
+    QTest::addColumn<Ranges>("expected");
+    Ranges one{Range{0, 10}};
+    QTest::newRow("empty range") << one << Range{5, 5} << one;
+    QTest::newRow("outside") << one << Range{10, 20} << one;
+    QTest::newRow("all") << one << Range{0, 10} << Ranges();
+    QTest::newRow("more than all") << one << Range{-5, 15} << Ranges();
+    QTest::newRow("split") << one << Range{4, 6}
+                           << (Ranges() << Range{0, 4} << Range{6, 10});
+    QTest::newRow("head") << one << Range{0, 4} << (Ranges() << Range{4, 10});
+    QTest::newRow("tail") << one << Range{6, 12} << (Ranges() << Range{0, 6});
+    QTest::newRow("across several")
+      << (Ranges() << Range{0, 10} << Range{20, 30} << Range{40, 50})
+      << Range{5, 45} << (Ranges() << Range{0, 5} << Range{45, 50});
+    QTest::newRow("gap between")
+      << (Ranges() << Range{0, 10} << Range{20, 30})
+      << Range{10, 20} << (Ranges() << Range{0, 10} << Range{20, 30});
+  }
+
+  void remove() {
+    QFETCH(Ranges, added);
+    QFETCH(Range, removed);
+    QFETCH(Ranges, expected);
+    auto set = makeSet(added);
+    set.remove(removed);
+    QCOMPARE(set.getRanges(), expected);
+    QCOMPARE(set.getBytes(), sumOf(expected));
+  }
+
+  void contains() {
+    auto set = makeSet(Ranges() << Range{0, 10} << Range{20, 30});
+    QVERIFY(set.contains(0));
+    QVERIFY(set.contains(9));
+    QVERIFY(!set.contains(10));
+    QVERIFY(!set.contains(-1));
+    QVERIFY(set.contains(Range{20, 30}));
+    QVERIFY(set.contains(Range{3, 3}));
+    QVERIFY(!set.contains(Range{5, 25}));
+    QVERIFY(!set.contains(Range{25, 31}));
+  }
+
+  void getMissing() {
+    auto set = makeSet(Ranges() << Range{10, 20} << Range{30, 40});
+    QCOMPARE(set.getMissing(0, 50),
+             Ranges() << Range{0, 10} << Range{20, 30} << Range{40, 50});
+    QCOMPARE(set.getMissing(15, 35), Ranges() << Range{20, 30});
+    QCOMPARE(set.getMissing(10, 20), Ranges());
+    QCOMPARE(RangeSet().getMissing(0, 5), Ranges() << Range{0, 5});
+  }
+
+  void serializes() {
+    auto set = makeSet(Ranges() << Range{0, 10} << Range{20, 30}
+                       << Range{4294967296, 8589934592});
+    QByteArray data;
+    {
+      QDataStream out{&data, QIODevice::WriteOnly};
+      out << set;
+    }
+    RangeSet read;
+    QDataStream in{data};
+    in >> read;
+    QCOMPARE(in.status(), QDataStream::Ok);
+    QCOMPARE(read.getRanges(), set.getRanges());
+    QCOMPARE(read.getBytes(), set.getBytes());
+
+    // Truncated data is not accepted.
+    RangeSet truncated;
+    QDataStream partial{data.left(data.size() - 4)};
+    partial >> truncated;
+    QVERIFY(partial.status() != QDataStream::Ok);
+  }
+
+  // Random additions and removals must agree with a plain bitmap.
+  void matchesBitmap() {
+    const int size{4096};
+    QVector<bool> bitmap(size, false);
+    RangeSet set;
+    qsrand(1);
+    for (int i = 0; i < 20000; i++) {
+      int start = qrand() % size, end = qMin(size, start + qrand() % 64);
+      bool add = (qrand() % 3 != 0);
+      if (add) {
+        set.add(Range{start, end});
+      }
+      else {
+        set.remove(Range{start, end});
+      }
+      std::fill(bitmap.begin() + start, bitmap.begin() + end, add);
+    }
+
+    RangeSet expected;
+    qint64 bytes{0};
+    for (int pos = 0; pos < size; pos++) {
+      QCOMPARE(set.contains(pos), bitmap[pos]);
+      if (bitmap[pos]) {
+        expected.add(Range{pos, pos + 1});
+        bytes++;
+      }
+    }
+    QCOMPARE(set.getRanges(), expected.getRanges());
+    QCOMPARE(set.getBytes(), bytes);
+  }
+
+  // Time per operation with millions of fragments, which must grow with
+  // the logarithm of the amount of fragments.
+  void fragments_data() {
+    QTest::addColumn<int>("count");
+    for (int count = 1000; count <= 4000000; count *= 4) {
+      QTest::newRow(qPrintable(QString::number(count))) << count;
+    }
+  }
+
+  void fragments() {
+    if (!TestUtil::isBenchmark()) {
+      QSKIP("Set EFDL_BENCH to run benchmarks");
+    }
+    QFETCH(int, count);
+
+    // Every other 4 KB in random order, like chunks arriving from many
+    // connections.
+    QVector<qint64> order(count);
+    for (int i = 0; i < count; i++) {
+      order[i] = i;
+    }
+    qsrand(1);
+    for (int i = count - 1; i > 0; i--) {
+      std::swap(order[i], order[qrand() % (i + 1)]);
+    }
+
+    RangeSet set;
+    QElapsedTimer timer;
+    timer.start();
+    foreach (qint64 i, order) {
+      set.add(Range{i * 8192, i * 8192 + 4096});
+    }
+    qint64 addNs{timer.nsecsElapsed()};
+    QCOMPARE(set.getCount(), count);
+
+    timer.restart();
+    QByteArray data;
+    {
+      QDataStream out{&data, QIODevice::WriteOnly};
+      out << set;
+    }
+    qint64 saveNs{timer.nsecsElapsed()};
+
+    // Filling the gaps merges everything into one range.
+    timer.restart();
+    foreach (qint64 i, order) {
+      set.add(Range{i * 8192 + 4096, i * 8192 + 8192});
+    }
+    qint64 mergeNs{timer.nsecsElapsed()};
+    QCOMPARE(set.getCount(), 1);
+
+    timer.restart();
+    foreach (qint64 i, order) {
+      set.remove(Range{i * 8192, i * 8192 + 4096});
+    }
+    qint64 removeNs{timer.nsecsElapsed()};
+    QCOMPARE(set.getCount(), count);
+
+    qDebug("%d fragments: add %.0f ns, merge %.0f ns, remove %.0f ns, "
+           "save %.1f ms (%.1f MB)", count, double(addNs) / count,
+           double(mergeNs) / count, double(removeNs) / count,
+           double(saveNs) / 1000000, double(data.size()) / 1048576);
+  }
+};
+
+QTEST_MAIN(RangeSetTest)
+#include "RangeSetTest.moc"
@@ -0,0 +1,73 @@
+#include <QtTest>
+
+#include "TestServer.h"
+#include "RemoteFile.h"
+
+USE_NAMESPACE
+
+namespace {
+  const qint64 SIZE{16 * 1048576}, LARGE{1073741824};
+}
+
+class RemoteFileTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void initTestCase() {
+    server.addSynthetic("/file", SIZE);
+    server.addSynthetic("/cut", SIZE);
+    server.setCutOff("/cut", 100000);
+    QVERIFY(server.listen());
+
+    noRanges.addSynthetic("/large", LARGE);
+    noRanges.setRanges(false);
+    QVERIFY(noRanges.listen());
+  }
+
+  void reads() {
+    RemoteFile file{server.getUrl("/file")};
+    file.setBlockSize(65536);
+    QVERIFY(file.open());
+    QCOMPARE(file.getSize(), SIZE);
+
+    QVERIFY(file.read(100000, 5000) == TestServer::synthetic(100000, 5000));
+    QVERIFY(file.read(SIZE - 10, 100) == TestServer::synthetic(SIZE - 10, 10));
+    QVERIFY(file.read(SIZE, 1).isEmpty());
+
+    // Read again from the cache.
+    quint64 requests{file.getRequests()};
+    QVERIFY(file.read(100000, 5000) == TestServer::synthetic(100000, 5000));
+    QCOMPARE(file.getRequests(), requests);
+  }
+
+  // The response of a server that ignores the range is not read to the
+  // end.
+  void abortsWithoutRanges() {
+    RemoteFile file{noRanges.getUrl("/large")};
+    QVERIFY(!file.open());
+    QCOMPARE(file.getError(), QString("Server does not support ranges"));
+    QVERIFY(noRanges.getBytesServed() < LARGE / 16);
+  }
+
+  // Blocks of a transfer that broke off are neither returned nor cached.
+  void failsShortRead() {
+    RemoteFile file{server.getUrl("/cut")};
+    file.setBlockSize(65536);
+    QVERIFY(file.open());
+    QVERIFY(file.read(60000, 10000).isEmpty());
+    QVERIFY(!file.getError().isEmpty());
+    QVERIFY(file.read(0, 1000) == TestServer::synthetic(0, 1000));
+  }
+
+  void failsOnErrorStatus() {
+    RemoteFile file{server.getUrl("/missing")};
+    QVERIFY(!file.open());
+    QVERIFY(file.getError().startsWith("HTTP code 404"));
+  }
+
+private:
+  TestServer server, noRanges;
+};
+
+QTEST_MAIN(RemoteFileTest)
+#include "RemoteFileTest.moc"
@@ -0,0 +1,112 @@
+#include <QDir>
+#include <QFile>
+#include <QtTest>
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include "TestUtil.h"
+#include "TestServer.h"
+
+USE_NAMESPACE
+
+namespace {
+  const int FILES{10000};
+
+  // Between one and eight KB so all of them fit in the probe.
+  qint64 sizeOf(int i) {
+    return 1024 + (i * 509) % 7169;
+  }
+
+  QString filePath(int i) {
+    return QString("/small-%1").arg(i);
+  }
+
+  // Runs efdl with the URLs on STDIN, like a list piped to it, and
+  // returns whether all of them were downloaded.
+  bool runEfdl(const QStringList &args, const QList<QUrl> &urls,
+               const QString &dir) {
+    QProcess proc;
+    proc.setStandardOutputFile(QProcess::nullDevice());
+    proc.setStandardErrorFile(QProcess::nullDevice());
+    proc.start(EFDL_BINARY, QStringList() << "-o" << dir << args);
+    if (!proc.waitForStarted()) {
+      return false;
+    }
+    foreach (const auto &url, urls) {
+      proc.write(url.toEncoded() + '\n');
+    }
+    proc.closeWriteChannel();
+    return proc.waitForFinished(600000) &&
+      proc.exitStatus() == QProcess::NormalExit && proc.exitCode() == 0;
+  }
+}
+
+class SmallFilesTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void initTestCase() {
+    for (int i = 0; i < FILES; i++) {
+      server.addSynthetic(filePath(i), sizeOf(i));
+    }
+    QVERIFY(server.listen());
+  }
+
+  // Files that fit in the probe are written as they are.
+  void downloadsFromStdin() {
+    QTemporaryDir dir;
+    QList<QUrl> urls;
+    for (int i = 0; i < 100; i++) {
+      urls << server.getUrl(filePath(i));
+    }
+    server.resetCounters();
+    QVERIFY(runEfdl(QStringList() << "--prefetch" << "8", urls, dir.path()));
+
+    // Only the probe of each file.
+    QCOMPARE(server.getRequests(), urls.size());
+    for (int i = 0; i < urls.size(); i++) {
+      QFile file{dir.path() + filePath(i)};
+      QVERIFY(file.open(QIODevice::ReadOnly));
+      QVERIFY(file.readAll() == TestServer::synthetic(0, sizeOf(i)));
+    }
+  }
+
+  void filesPerSecond_data() {
+    QTest::addColumn<QStringList>("args");
+    QTest::newRow("prefetch 1") << (QStringList() << "--prefetch" << "1");
+    QTest::newRow("prefetch 4") << (QStringList() << "--prefetch" << "4");
+    QTest::newRow("prefetch 32") << (QStringList() << "--prefetch" << "32");
+
+    // Probes smaller than the files take the path of large files.
+    QTest::newRow("chunked, prefetch 4")
+      << (QStringList() << "--prefetch" << "4" << "--chunk-size" << "512");
+  }
+
+  // Files per second of downloading a list of 10,000 small files.
+  void filesPerSecond() {
+    if (!TestUtil::isBenchmark()) {
+      QSKIP("Set EFDL_BENCH to run benchmarks");
+    }
+    QFETCH(QStringList, args);
+
+    QTemporaryDir dir{TestUtil::benchDir()};
+    QList<QUrl> urls;
+    for (int i = 0; i < FILES; i++) {
+      urls << server.getUrl(filePath(i));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(runEfdl(args, urls, dir.path()));
+    qint64 msecs{qMax(timer.elapsed(), qint64(1))};
+    QCOMPARE(QDir{dir.path()}.entryList(QDir::Files).size(), FILES);
+    qDebug("%d files: %.0f files/s", FILES, double(FILES) * 1000 / msecs);
+  }
+
+private:
+  TestServer server;
+};
+
+QTEST_MAIN(SmallFilesTest)
+#include "SmallFilesTest.moc"
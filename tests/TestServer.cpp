@@ -0,0 +1,311 @@
+#include <QHash>
+#include <QList>
+#include <QTimer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+
+#include "TestServer.h"
+
+namespace {
+  // Bodies are written in pieces while less than the high-water mark is
+  // waiting to be sent, so huge ranges are never held in memory.
+  const qint64 PIECE{262144};
+  const qint64 HIGH_WATER{4194304};
+
+  QByteArray reasonFor(int code) {
+    switch (code) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 404: return "Not Found";
+    case 416: return "Range Not Satisfiable";
+    default: return "Unknown";
+    }
+  }
+}
+
+BEGIN_NAMESPACE
+
+class TestServer::Connection : public QObject {
+public:
+  Connection(TestServer &server, QTcpSocket *socket);
+
+private:
+  void onReadyRead();
+  void respond(const QByteArray &head);
+  void sendMore();
+
+  TestServer &server;
+  QTcpSocket *socket;
+  QByteArray input;
+  const Resource *res;
+  qint64 pos, end; // [pos, end[ of the body left to send
+  bool sending, close;
+  QTimer timer;
+};
+
+TestServer::Connection::Connection(TestServer &server, QTcpSocket *socket)
+  : QObject(socket), server(server), socket{socket}, res{nullptr}, pos{0},
+    end{0}, sending{false}, close{false}
+{
+  timer.setSingleShot(true);
+  connect(socket, &QTcpSocket::readyRead, this, [this] { onReadyRead(); });
+  connect(socket, &QTcpSocket::bytesWritten,
+          this, [this](qint64) { sendMore(); });
+  connect(&timer, &QTimer::timeout, this, [this] { sendMore(); });
+  connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+}
+
+void TestServer::Connection::onReadyRead() {
+  input += socket->readAll();
+
+  // Pipelined requests are answered one at a time, in order.
+  while (!sending) {
+    int idx = input.indexOf("\r\n\r\n");
+    if (idx == -1) {
+      return;
+    }
+    QByteArray head{input.left(idx)};
+    input.remove(0, idx + 4);
+    respond(head);
+  }
+}
+
+void TestServer::Connection::respond(const QByteArray &head) {
+  QList<QByteArray> lines{head.split('\n')};
+  QList<QByteArray> request{lines.takeFirst().trimmed().split(' ')};
+  QHash<QByteArray, QByteArray> headers;
+  foreach (const auto &line, lines) {
+    int colon = line.indexOf(':');
+    if (colon != -1) {
+      headers[line.left(colon).trimmed().toLower()] =
+        line.mid(colon + 1).trimmed();
+    }
+  }
+
+  QByteArray method{request.value(0)}, path{request.value(1)};
+  if (path.contains('?')) {
+    path = path.left(path.indexOf('?'));
+  }
+  close = (headers.value("connection").toLower() == "close");
+  server.count(headers.value("range"));
+
+  // Resources are not changed while running.
+  auto it = server.resources.constFind(QString::fromUtf8(path));
+  res = (it == server.resources.constEnd() ? nullptr : &it.value());
+
+  int code{404};
+  qint64 size{0}, first{0}, last{-1};
+  QByteArray extra;
+  if (res) {
+    code = 200;
+    size = res->size;
+    last = size - 1;
+    if (!res->etag.isEmpty() && headers.value("if-none-match") == res->etag) {
+      code = 304;
+      last = -1;
+    }
+    else if (server.ranges && headers.contains("range")) {
+      // A range that does not match the current validator gets all of it.
+      QByteArray ifRange{headers.value("if-range")};
+      bool current{ifRange.isEmpty() ||
+          (!res->etag.isEmpty() && ifRange == res->etag)};
+      QList<QByteArray> parts{headers.value("range").mid(6).split('-')};
+      bool okFirst, okLast{true};
+      qint64 from{parts.value(0).toLongLong(&okFirst)},
+        to{parts.value(1).isEmpty() ? size - 1
+           : parts.value(1).toLongLong(&okLast)};
+      if (current && headers.value("range").startsWith("bytes=") &&
+          parts.size() == 2 && okFirst && okLast) {
+        if (from >= size || from > to) {
+          code = 416;
+          last = -1;
+          extra += "Content-Range: bytes */" + QByteArray::number(size) +
+            "\r\n";
+        }
+        else {
+          code = 206;
+          first = from;
+          last = qMin(to, size - 1);
+          extra += "Content-Range: bytes " + QByteArray::number(first) +
+            "-" + QByteArray::number(last) + "/" + QByteArray::number(size) +
+            "\r\n";
+        }
+      }
+    }
+    if (server.ranges) {
+      extra += "Accept-Ranges: bytes\r\n";
+    }
+    if (!res->etag.isEmpty()) {
+      extra += "ETag: " + res->etag + "\r\n";
+    }
+  }
+
+  QByteArray reply{"HTTP/1.1 " + QByteArray::number(code) + " " +
+      reasonFor(code) + "\r\n"};
+  if (code != 304) {
+    reply += "Content-Length: " + QByteArray::number(last - first + 1) +
+      "\r\n";
+  }
+  reply += extra;
+  reply += (close ? "Connection: close\r\n" : "Connection: keep-alive\r\n");
+  reply += "\r\n";
+  socket->write(reply);
+
+  pos = first;
+  end = (method == "HEAD" ? first : last + 1);
+  sending = true;
+  sendMore();
+}
+
+void TestServer::Connection::sendMore() {
+  if (!sending || timer.isActive()) {
+    return;
+  }
+  qint64 stop{res && res->cutOff >= 0 ? qMin(end, res->cutOff) : end};
+  while (pos < stop && socket->bytesToWrite() < HIGH_WATER) {
+    qint64 len{qMin(stop - pos, PIECE)};
+    if (server.rate > 0) {
+      // A hundredth of the rate every 10 ms.
+      len = qMin(len, qMax(server.rate / 100, qint64(1)));
+    }
+    socket->write(res->synthetic ? TestServer::synthetic(pos, len)
+                  : res->data.mid(pos, len));
+    server.served(len);
+    pos += len;
+    if (server.rate > 0) {
+      timer.start(10);
+      return;
+    }
+  }
+  if (pos < stop) {
+    return;
+  }
+
+  sending = false;
+  if (pos < end) {
+    socket->disconnectFromHost();
+    return;
+  }
+  if (close) {
+    socket->disconnectFromHost();
+    return;
+  }
+  onReadyRead();
+}
+
+TestServer::TestServer()
+  : ranges{true}, rate{0}, port{0}, requests{0}, bytesServed{0}
+{ }
+
+TestServer::~TestServer() {
+  quit();
+  wait();
+}
+
+void TestServer::addFile(const QString &path, const QByteArray &data) {
+  Resource res;
+  res.data = data;
+  res.size = data.size();
+  res.cutOff = -1;
+  res.synthetic = false;
+  res.etag = "\"" + QByteArray::number(qHash(path), 16) + "-" +
+    QByteArray::number(res.size, 16) + "\"";
+  resources[path] = res;
+}
+
+void TestServer::addSynthetic(const QString &path, qint64 size) {
+  addFile(path, QByteArray());
+  auto &res = resources[path];
+  res.size = size;
+  res.synthetic = true;
+  res.etag = "\"" + QByteArray::number(qHash(path), 16) + "-" +
+    QByteArray::number(size, 16) + "\"";
+}
+
+void TestServer::setCutOff(const QString &path, qint64 pos) {
+  resources[path].cutOff = pos;
+}
+
+void TestServer::setETag(const QString &path, const QByteArray &etag) {
+  resources[path].etag = etag;
+}
+
+bool TestServer::listen() {
+  start();
+  ready.acquire();
+  return port != 0;
+}
+
+QUrl TestServer::getUrl(const QString &path) const {
+  return QUrl{QString("http://127.0.0.1:%1%2").arg(port).arg(path)};
+}
+
+char TestServer::byteAt(qint64 pos) {
+  // Multiplicative hashing so data ending up at the wrong position,
+  // even a multiple of a power of two away, is noticed.
+  return char((quint64(pos) * Q_UINT64_C(0x9E3779B97F4A7C15)) >> 56);
+}
+
+QByteArray TestServer::synthetic(qint64 pos, qint64 len) {
+  QByteArray data(len, Qt::Uninitialized);
+  char *ptr = data.data();
+  for (qint64 i = 0; i < len; i++) {
+    ptr[i] = byteAt(pos + i);
+  }
+  return data;
+}
+
+int TestServer::getRequests() const {
+  QMutexLocker locker{&mutex};
+  return requests;
+}
+
+qint64 TestServer::getBytesServed() const {
+  QMutexLocker locker{&mutex};
+  return bytesServed;
+}
+
+QStringList TestServer::getRangeHeaders() const {
+  QMutexLocker locker{&mutex};
+  return rangeHeaders;
+}
+
+void TestServer::resetCounters() {
+  QMutexLocker locker{&mutex};
+  requests = 0;
+  bytesServed = 0;
+  rangeHeaders.clear();
+}
+
+void TestServer::run() {
+  QTcpServer server;
+  if (!server.listen(QHostAddress::LocalHost)) {
+    ready.release();
+    return;
+  }
+  port = server.serverPort();
+  connect(&server, &QTcpServer::newConnection, [this, &server] {
+    while (server.hasPendingConnections()) {
+      new Connection(*this, server.nextPendingConnection());
+    }
+  });
+  ready.release();
+  exec();
+}
+
+void TestServer::count(const QByteArray &range) {
+  QMutexLocker locker{&mutex};
+  requests++;
+  if (!range.isEmpty()) {
+    rangeHeaders << QString::fromUtf8(range);
+  }
+}
+
+void TestServer::served(qint64 bytes) {
+  QMutexLocker locker{&mutex};
+  bytesServed += bytes;
+}
+
+END_NAMESPACE
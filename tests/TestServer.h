@@ -0,0 +1,95 @@
+#ifndef EFDL_TEST_SERVER_H
+#define EFDL_TEST_SERVER_H
+
+#include <QUrl>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QString>
+#include <QSemaphore>
+#include <QByteArray>
+#include <QStringList>
+
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+/**
+ * Minimal HTTP/1.1 server on the loopback interface for tests and
+ * benchmarks. It runs in its own thread so tests can block while
+ * downloads, or other processes, talk to it. Resources are added before
+ * listen() and are either kept in memory or synthetic, which can be of
+ * any size because their content is computed from the position.
+ *
+ * Supports GET and HEAD with keep-alive, single byte ranges, If-Range
+ * and If-None-Match.
+ */
+class TestServer : public QThread {
+  Q_OBJECT
+
+public:
+  TestServer();
+  ~TestServer();
+
+  void addFile(const QString &path, const QByteArray &data);
+
+  // Content of the size where the byte at each position is byteAt().
+  void addSynthetic(const QString &path, qint64 size);
+
+  // Each resource gets a strong entity tag unless it is set to empty.
+  void setETag(const QString &path, const QByteArray &etag);
+
+  // Connections are closed when the body reaches the position, like a
+  // transfer that breaks off.
+  void setCutOff(const QString &path, qint64 pos);
+
+  // Whether ranges are served, otherwise everything is sent with 200.
+  void setRanges(bool ranges) { this->ranges = ranges; }
+
+  // Bytes per second per connection, if positive.
+  void setRate(qint64 rate) { this->rate = rate; }
+
+  // Starts listening on a free port and returns false if not possible.
+  bool listen();
+  QUrl getUrl(const QString &path) const;
+
+  static char byteAt(qint64 pos);
+  static QByteArray synthetic(qint64 pos, qint64 len);
+
+  int getRequests() const;
+  qint64 getBytesServed() const;
+
+  // Values of the Range headers of all requests so far.
+  QStringList getRangeHeaders() const;
+  void resetCounters();
+
+protected:
+  void run() override;
+
+private:
+  class Connection;
+
+  struct Resource {
+    QByteArray data, etag;
+    qint64 size, cutOff;
+    bool synthetic;
+  };
+
+  void count(const QByteArray &range);
+  void served(qint64 bytes);
+
+  QHash<QString, Resource> resources; // path -> resource
+  bool ranges;
+  qint64 rate;
+  quint16 port;
+  QSemaphore ready;
+
+  int requests;
+  qint64 bytesServed;
+  QStringList rangeHeaders;
+  mutable QMutex mutex;
+};
+
+END_NAMESPACE
+
+#endif // EFDL_TEST_SERVER_H
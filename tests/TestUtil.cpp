@@ -0,0 +1,55 @@
+#include <QDir>
+#include <QFile>
+
+#include <algorithm>
+
+#include "TestUtil.h"
+#include "MemoryBudget.h"
+#include "CommitThread.h"
+
+BEGIN_NAMESPACE
+
+bool TestUtil::isBenchmark() {
+  return !qgetenv("EFDL_BENCH").isEmpty();
+}
+
+QString TestUtil::benchDir() {
+  QString dir{QString::fromLocal8Bit(qgetenv("EFDL_BENCH_DIR"))};
+  return (dir.isEmpty() ? QDir::tempPath() : dir) + "/efdl-XXXXXX";
+}
+
+QList<Range> TestUtil::makeChunks(qint64 size, qint64 chunkSize) {
+  QList<Range> chunks;
+  for (qint64 pos = 0; pos < size; pos += chunkSize) {
+    chunks << Range{pos, qMin(pos + chunkSize, size)};
+  }
+  for (int i = 0; i < chunks.size(); i += 8) {
+    std::reverse(chunks.begin() + i,
+                 chunks.begin() + qMin(i + 8, chunks.size()));
+  }
+  return chunks;
+}
+
+bool TestUtil::commitAll(CommitThread &thread, const QString &path,
+                         const QList<Range> &chunks, const Make &make) {
+  auto *file = new QFile{path};
+  if (!file->open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+    delete file;
+    return false;
+  }
+  MemoryBudget budget{67108864};
+  thread.setFile(file);
+  thread.setMemoryBudget(&budget);
+  thread.start();
+  for (int i = 0; i < chunks.size(); i++) {
+    const auto &chunk = chunks[i];
+    qint64 len{chunk.second - chunk.first};
+    budget.acquire(len);
+    thread.enqueueChunk(chunk.first, new QByteArray(make(chunk.first, len)),
+                        i == chunks.size() - 1);
+  }
+  thread.wait();
+  return !thread.hasError();
+}
+
+END_NAMESPACE
@@ -0,0 +1,41 @@
+#ifndef EFDL_TEST_UTIL_H
+#define EFDL_TEST_UTIL_H
+
+#include <QList>
+#include <QString>
+#include <QByteArray>
+
+#include <functional>
+
+#include "Range.h"
+#include "EfdlGlobal.h"
+
+BEGIN_NAMESPACE
+
+class CommitThread;
+
+class TestUtil {
+public:
+  typedef std::function<QByteArray(qint64 pos, qint64 len)> Make;
+
+  // Benchmarks only run when EFDL_BENCH is set.
+  static bool isBenchmark();
+
+  // Template for a temporary directory in EFDL_BENCH_DIR, if set, so
+  // file systems like tmpfs and a disk can be compared.
+  static QString benchDir();
+
+  // [start, end[ chunks of the size, reversed within groups of eight
+  // like connections finishing out of order.
+  static QList<Range> makeChunks(qint64 size, qint64 chunkSize);
+
+  // Commits the chunks to the file in the order given, with at most 64
+  // MB in memory like a download with a memory budget. The data of each
+  // chunk is made by the function.
+  static bool commitAll(CommitThread &thread, const QString &path,
+                        const QList<Range> &chunks, const Make &make);
+};
+
+END_NAMESPACE
+
+#endif // EFDL_TEST_UTIL_H
@@ -0,0 +1,101 @@
+#include <QFile>
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "TestUtil.h"
+#include "TestServer.h"
+#include "CommitThread.h"
+
+USE_NAMESPACE
+
+Q_DECLARE_METATYPE(EFDL_NAMESPACE::WriteBackend::Type)
+
+class WriteBackendTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void writes_data() {
+    QTest::addColumn<WriteBackend::Type>("type");
+    QTest::addColumn<qint64>("chunkSize");
+    QTest::newRow("qfile") << WriteBackend::Type::File << qint64(1048573);
+    QTest::newRow("pwrite") << WriteBackend::Type::Pwrite << qint64(65537);
+    QTest::newRow("pwrite large") << WriteBackend::Type::Pwrite
+                                  << qint64(8388608);
+    QTest::newRow("auto") << WriteBackend::Type::Auto << qint64(65537);
+    QTest::newRow("auto large") << WriteBackend::Type::Auto
+                                << qint64(8388608);
+  }
+
+  void writes() {
+    QFETCH(WriteBackend::Type, type);
+    QFETCH(qint64, chunkSize);
+
+    const qint64 size{67108864 + 4321};
+    QTemporaryDir dir;
+    QString path{dir.path() + "/out"};
+    CommitThread thread;
+    thread.setBackendType(type);
+    QVERIFY(TestUtil::commitAll(thread, path,
+                                TestUtil::makeChunks(size, chunkSize),
+                                &TestServer::synthetic));
+    QCOMPARE(thread.getBytesWritten(), size);
+
+    QFile file{path};
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.size(), size);
+    for (qint64 pos = 0; pos < size; pos += 1048576) {
+      QByteArray data{file.read(1048576)};
+      QVERIFY(data == TestServer::synthetic(pos, data.size()));
+    }
+  }
+
+  void throughput_data() {
+    QTest::addColumn<WriteBackend::Type>("type");
+    QTest::addColumn<qint64>("chunkSize");
+    QList<QPair<QString, WriteBackend::Type>> types{
+      {"qfile", WriteBackend::Type::File},
+      {"pwrite", WriteBackend::Type::Pwrite},
+      {"io_uring", WriteBackend::Type::IoUring}};
+    QList<qint64> chunkSizes{65536, 1048576, 16777216};
+    foreach (const auto &type, types) {
+      foreach (qint64 chunkSize, chunkSizes) {
+        QTest::newRow(qPrintable(QString("%1 %2 KB").arg(type.first)
+                                 .arg(chunkSize / 1024)))
+          << type.second << chunkSize;
+      }
+    }
+  }
+
+  // MB/s and system calls per GB of writing 1 GB.
+  void throughput() {
+    if (!TestUtil::isBenchmark()) {
+      QSKIP("Set EFDL_BENCH to run benchmarks");
+    }
+    QFETCH(WriteBackend::Type, type);
+    QFETCH(qint64, chunkSize);
+
+    const qint64 size{1073741824};
+    QTemporaryDir dir{TestUtil::benchDir()};
+    QByteArray pattern{TestServer::synthetic(0, chunkSize)};
+    CommitThread thread;
+    thread.setBackendType(type);
+    QVERIFY(TestUtil::commitAll(thread, dir.path() + "/out",
+                                TestUtil::makeChunks(size, chunkSize),
+                                [&pattern](qint64, qint64 len) {
+                                  return pattern.left(len);
+                                }));
+    if (type == WriteBackend::Type::IoUring &&
+        thread.getBackendName() != "io_uring") {
+      QSKIP("io_uring is not available");
+    }
+
+    qint64 msecs{qMax(thread.getElapsed(), qint64(1))};
+    qDebug("%s: %.0f MB/s, %.0f syscalls/GB",
+           qPrintable(thread.getBackendName()),
+           double(size) / 1048576 * 1000 / msecs,
+           double(thread.getSyscalls()) * 1073741824 / size);
+  }
+};
+
+QTEST_MAIN(WriteBackendTest)
+#include "WriteBackendTest.moc"